@@ -0,0 +1,220 @@
+#include "aabbTree.h"
+
+#include <algorithm>
+
+namespace
+{
+	Aabb merge(const Aabb &a, const Aabb &b)
+	{
+		return Aabb(min(a.a, b.a), max(a.b, b.b));
+	}
+}
+
+uint32 AabbTree::allocate()
+{
+	if (freeList == m)
+	{
+		nodes.emplace_back();
+		return numeric_cast<uint32>(nodes.size() - 1);
+	}
+	const uint32 index = freeList;
+	freeList = nodes[index].parent;
+	nodes[index] = Node();
+	return index;
+}
+
+void AabbTree::release(uint32 index)
+{
+	Node &n = nodes[index];
+	n.parent = freeList;
+	n.children[0] = n.children[1] = m;
+	n.height = -1;
+	freeList = index;
+}
+
+void AabbTree::refit(uint32 index)
+{
+	Node &n = nodes[index];
+	const Node &a = nodes[n.children[0]];
+	const Node &b = nodes[n.children[1]];
+	n.box = merge(a.box, b.box);
+	n.height = 1 + std::max(a.height, b.height);
+}
+
+uint32 AabbTree::balance(uint32 iA)
+{
+	Node &A = nodes[iA];
+	if (A.leaf() || A.height < 2)
+		return iA;
+
+	const uint32 iB = A.children[0];
+	const uint32 iC = A.children[1];
+	Node &B = nodes[iB];
+	Node &C = nodes[iC];
+	const sint32 diff = C.height - B.height;
+
+	const auto &replaceInParent = [&](uint32 iNew) {
+		Node &N = nodes[iNew];
+		N.parent = A.parent;
+		A.parent = iNew;
+		if (N.parent == m)
+			rootIndex = iNew;
+		else
+		{
+			Node &P = nodes[N.parent];
+			P.children[P.children[0] == iA ? 0 : 1] = iNew;
+		}
+	};
+
+	// rotate C up
+	if (diff > 1)
+	{
+		const uint32 iF = C.children[0];
+		const uint32 iG = C.children[1];
+		C.children[0] = iA;
+		replaceInParent(iC);
+		const bool keepF = nodes[iF].height > nodes[iG].height;
+		const uint32 iKeep = keepF ? iF : iG;
+		const uint32 iMove = keepF ? iG : iF;
+		C.children[1] = iKeep;
+		A.children[1] = iMove;
+		nodes[iMove].parent = iA;
+		refit(iA);
+		refit(iC);
+		return iC;
+	}
+
+	// rotate B up
+	if (diff < -1)
+	{
+		const uint32 iD = B.children[0];
+		const uint32 iE = B.children[1];
+		B.children[0] = iA;
+		replaceInParent(iB);
+		const bool keepD = nodes[iD].height > nodes[iE].height;
+		const uint32 iKeep = keepD ? iD : iE;
+		const uint32 iMove = keepD ? iE : iD;
+		B.children[1] = iKeep;
+		A.children[0] = iMove;
+		nodes[iMove].parent = iA;
+		refit(iA);
+		refit(iB);
+		return iB;
+	}
+
+	return iA;
+}
+
+uint32 AabbTree::insert(const Aabb &box)
+{
+	CAGE_ASSERT(box.valid());
+	const uint32 leaf = allocate();
+	nodes[leaf].box = box;
+	leaves++;
+
+	if (rootIndex == m)
+	{
+		rootIndex = leaf;
+		return leaf;
+	}
+
+	// find the best sibling by the surface area heuristic
+	uint32 index = rootIndex;
+	while (!nodes[index].leaf())
+	{
+		const Node &n = nodes[index];
+		const Real area = n.box.surface();
+		const Real combinedArea = merge(n.box, box).surface();
+		const Real cost = 2 * combinedArea; // cost of creating a new parent for this node and the new leaf
+		const Real inheritance = 2 * (combinedArea - area); // minimum cost of pushing the leaf further down
+		Real childCost[2];
+		for (uint32 i = 0; i < 2; i++)
+		{
+			const Node &c = nodes[n.children[i]];
+			const Real merged = merge(c.box, box).surface();
+			childCost[i] = (c.leaf() ? merged : merged - c.box.surface()) + inheritance;
+		}
+		if (cost < childCost[0] && cost < childCost[1])
+			break;
+		index = n.children[childCost[0] < childCost[1] ? 0 : 1];
+	}
+
+	// create a new parent
+	const uint32 sibling = index;
+	const uint32 oldParent = nodes[sibling].parent;
+	const uint32 newParent = allocate();
+	{
+		Node &p = nodes[newParent];
+		p.parent = oldParent;
+		p.children[0] = sibling;
+		p.children[1] = leaf;
+	}
+	refit(newParent);
+	nodes[sibling].parent = newParent;
+	nodes[leaf].parent = newParent;
+	if (oldParent == m)
+		rootIndex = newParent;
+	else
+	{
+		Node &op = nodes[oldParent];
+		op.children[op.children[0] == sibling ? 0 : 1] = newParent;
+	}
+
+	// walk back up, fixing heights and boxes
+	index = nodes[leaf].parent;
+	while (index != m)
+	{
+		index = balance(index);
+		refit(index);
+		index = nodes[index].parent;
+	}
+
+	return leaf;
+}
+
+void AabbTree::remove(uint32 leaf)
+{
+	CAGE_ASSERT(leaf < nodes.size() && nodes[leaf].leaf() && nodes[leaf].height == 0);
+	CAGE_ASSERT(leaves > 0);
+	leaves--;
+
+	if (leaf == rootIndex)
+	{
+		rootIndex = m;
+		release(leaf);
+		return;
+	}
+
+	const uint32 parent = nodes[leaf].parent;
+	const uint32 grandParent = nodes[parent].parent;
+	const uint32 sibling = nodes[parent].children[nodes[parent].children[0] == leaf ? 1 : 0];
+	release(leaf);
+	release(parent);
+
+	if (grandParent == m)
+	{
+		rootIndex = sibling;
+		nodes[sibling].parent = m;
+		return;
+	}
+
+	Node &g = nodes[grandParent];
+	g.children[g.children[0] == parent ? 0 : 1] = sibling;
+	nodes[sibling].parent = grandParent;
+
+	uint32 index = grandParent;
+	while (index != m)
+	{
+		index = balance(index);
+		refit(index);
+		index = nodes[index].parent;
+	}
+}
+
+void AabbTree::clear()
+{
+	nodes.clear();
+	rootIndex = m;
+	freeList = m;
+	leaves = 0;
+}
@@ -0,0 +1,72 @@
+#ifndef flittermouse_aabbTree_h_k7d5g4s1
+#define flittermouse_aabbTree_h_k7d5g4s1
+
+#include "common.h"
+
+#include <cage-core/geometry.h>
+
+#include <vector>
+
+// dynamic bounding volume hierarchy with incremental insertion and removal
+// inserting and removing a leaf costs O(log n), the tree is kept balanced by local rotations
+// based on the dynamic tree from Box2D by Erin Catto
+struct AabbTree
+{
+	struct Node
+	{
+		Aabb box;
+		uint32 parent = m; // next free node when in the free list
+		uint32 children[2] = { m, m };
+		sint32 height = 0; // leaf = 0, free = -1
+		bool leaf() const { return children[0] == m; }
+	};
+
+	// returns index of the leaf, which is stable until the leaf is removed
+	uint32 insert(const Aabb &box);
+	void remove(uint32 leaf);
+	void clear();
+
+	const Node &node(uint32 index) const { return nodes[index]; }
+	uint32 root() const { return rootIndex; }
+	uint32 leavesCount() const { return leaves; }
+	sint32 height() const { return rootIndex == m ? 0 : nodes[rootIndex].height; }
+
+	// calls the function with index of each leaf whose box passes the test
+	template<class Test, class Function>
+	void query(Test &&test, Function &&function) const
+	{
+		if (rootIndex == m)
+			return;
+		uint32 stack[128];
+		uint32 stackSize = 0;
+		stack[stackSize++] = rootIndex;
+		while (stackSize)
+		{
+			const uint32 index = stack[--stackSize];
+			const Node &n = nodes[index];
+			if (!test(n.box))
+				continue;
+			if (n.leaf())
+			{
+				function(index);
+				continue;
+			}
+			CAGE_ASSERT(stackSize + 2 <= sizeof(stack) / sizeof(stack[0]));
+			stack[stackSize++] = n.children[0];
+			stack[stackSize++] = n.children[1];
+		}
+	}
+
+private:
+	std::vector<Node> nodes;
+	uint32 rootIndex = m;
+	uint32 freeList = m;
+	uint32 leaves = 0;
+
+	uint32 allocate();
+	void release(uint32 index);
+	uint32 balance(uint32 index);
+	void refit(uint32 index);
+};
+
+#endif
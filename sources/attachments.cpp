@@ -0,0 +1,102 @@
+#include "common.h"
+#include "profiler.h"
+#include "tickBudget.h"
+
+#include <cage-core/entities.h>
+#include <cage-engine/scene.h>
+#include <cage-simple/engine.h>
+
+#include <vector>
+
+namespace
+{
+	// nodes are stored in topological order, a parent always precedes its children
+	// roots follow the transform of an entity, all other nodes write their world transform to their entity
+	std::vector<uint32> parents; // m for roots
+	std::vector<Transform> locals;
+	std::vector<Transform> worlds;
+	std::vector<uint32> names; // entity names, resolved every tick, so that destroyed entities are skipped
+
+	TickBudget tickBudget("attachments");
+
+	void engineUpdate()
+	{
+		TickBudgetScope budgetScope(tickBudget);
+		FLITTERMOUSE_PROFILE("attachments update");
+		EntityManager *ents = engineEntities();
+		const uint32 cnt = numeric_cast<uint32>(parents.size());
+		const uint32 *par = parents.data();
+		const Transform *loc = locals.data();
+		Transform *wor = worlds.data();
+		for (uint32 i = 0; i < cnt; i++)
+		{
+			if (par[i] == m)
+			{
+				Entity *e = ents->tryGet(names[i]);
+				wor[i] = e && e->has<TransformComponent>() ? Transform(e->value<TransformComponent>()) : Transform();
+			}
+			else
+			{
+				CAGE_ASSERT(par[i] < i);
+				wor[i] = wor[par[i]] * loc[i];
+			}
+		}
+		for (uint32 i = 0; i < cnt; i++)
+		{
+			if (par[i] == m)
+				continue;
+			if (Entity *e = ents->tryGet(names[i]))
+				e->value<TransformComponent>() = wor[i];
+		}
+	}
+
+	void engineFinalize()
+	{
+		parents.clear();
+		locals.clear();
+		worlds.clear();
+		names.clear();
+	}
+
+	class Callbacks
+	{
+		EventListener<void()> engineUpdateListener;
+		EventListener<void()> engineFinalizeListener;
+	public:
+		Callbacks()
+		{
+			// after the ship moves and before the doodads aim
+			engineUpdateListener.attach(controlThread().update, 50);
+			engineUpdateListener.bind<&engineUpdate>();
+			engineFinalizeListener.attach(controlThread().finalize);
+			engineFinalizeListener.bind<&engineFinalize>();
+		}
+	} callbacksInstance;
+}
+
+uint32 attachmentRoot(uint32 entityName)
+{
+	CAGE_ASSERT(entityName != 0);
+	parents.push_back(m);
+	locals.push_back(Transform());
+	worlds.push_back(Transform());
+	names.push_back(entityName);
+	return numeric_cast<uint32>(parents.size() - 1);
+}
+
+uint32 attachmentCreate(Entity *e, uint32 parent, const Transform &local)
+{
+	CAGE_ASSERT(e && e->name() != 0);
+	CAGE_ASSERT(parent < parents.size());
+	parents.push_back(parent);
+	locals.push_back(local);
+	worlds.push_back(worlds[parent] * local);
+	names.push_back(e->name());
+	return numeric_cast<uint32>(parents.size() - 1);
+}
+
+const Transform &attachmentWorld(uint32 node)
+{
+	CAGE_ASSERT(node < worlds.size());
+	return worlds[node];
+}
@@ -1,98 +1,560 @@
 #include "common.h"
+#include "tileCollider.h"
+#include "aabbTree.h"
+#include "profiler.h"
 
-#include <cage-core/entities.h>
-#include <cage-core/hashString.h>
 #include <cage-core/geometry.h>
-#include <cage-core/collider.h>
-#include <cage-core/collisionStructure.h>
-#include <cage-engine/scene.h>
+#include <cage-core/concurrent.h>
+#include <cage-core/tasks.h>
+#include <cage-core/config.h>
 #include <cage-simple/engine.h>
 
+#include <unordered_map>
+#include <vector>
+#include <atomic>
+
 using namespace cage;
 
 namespace
 {
-	Holder<CollisionStructure> collisionSearchData;
-	Holder<CollisionQuery> collisionSearchQuery;
-	bool collisionSearchNeedsRebuild;
+	struct ColliderInstance
+	{
+		Holder<const TileCollider> collider;
+		Transform transform;
+		Transform inverse;
+		Aabb box; // world space
+		uint32 name = 0;
+	};
+
+	struct CollisionCommand
+	{
+		uint32 name = 0;
+		ColliderInstance instance; // empty collider for removal
+	};
+}
+
+// top level over the tiles, each collider has its own bvh
+struct TerrainCollisionWorld
+{
+	AabbTree tree;
+	std::vector<ColliderInstance> instances; // indexed by leaves of the tree
+	std::unordered_map<uint32, uint32> leaves; // name -> leaf
+
+	void remove(uint32 name)
+	{
+		const auto it = leaves.find(name);
+		if (it == leaves.end())
+			return;
+		tree.remove(it->second);
+		instances[it->second] = ColliderInstance();
+		leaves.erase(it);
+	}
+
+	void add(uint32 name, ColliderInstance &&inst)
+	{
+		remove(name);
+		const uint32 leaf = tree.insert(inst.box);
+		if (leaf >= instances.size())
+			instances.resize(leaf + 1);
+		instances[leaf] = std::move(inst);
+		leaves[name] = leaf;
+	}
+
+	void apply(CollisionCommand &&cmd)
+	{
+		if (cmd.instance.collider)
+			add(cmd.name, std::move(cmd.instance));
+		else
+			remove(cmd.name);
+	}
+};
+
+namespace
+{
+	// both buffers of the world are owned by the maintenance thread
+	// the back buffer is modified only after all queries have released it, and then the changes since its last publishing are replayed
+	TerrainCollisionWorld worlds[2];
+
+	Holder<Mutex> commandsMutex;
+	std::vector<CollisionCommand> commands; // changes not yet applied by the maintenance thread
+	Holder<Semaphore> commandsSemaphore; // signaled when the commands become non-empty, or when stopping
+	Holder<Semaphore> releasedSemaphore; // one token per buffer that is not referenced by any snapshot
+	Holder<Mutex> snapshotMutex;
+	Holder<const TerrainCollisionSnapshot> published; // latest
+	Holder<Thread> maintenanceThread;
+	std::atomic<bool> stopping;
+}
+
+// immutable while referenced, may be shared by any number of threads
+struct TerrainCollisionSnapshot
+{
+	const TerrainCollisionWorld *world = nullptr;
+
+	~TerrainCollisionSnapshot()
+	{
+		releasedSemaphore->unlock();
+	}
+};
+
+namespace
+{
+	const ConfigBool confDebugRays("flittermouse/collision/debugRays", false); // draw every query with the debug lines
+
+	// packets in one batch needed to split it between multiple threads
+	constexpr uint32 ParallelPackets = 8;
+
+	// triangles tested around the cached one
+	constexpr uint32 CacheNeighbourhood = 16;
+
+	std::atomic<uint64> cacheQueries;
+	std::atomic<uint64> cacheHits;
+
+	void debugHit(const Vec3 &p)
+	{
+		constexpr Real S = 0.05;
+		renderDebugLine(p - Vec3(S, 0, 0), p + Vec3(S, 0, 0), Vec3(1, 0, 0));
+		renderDebugLine(p - Vec3(0, S, 0), p + Vec3(0, S, 0), Vec3(1, 0, 0));
+		renderDebugLine(p - Vec3(0, 0, S), p + Vec3(0, 0, S), Vec3(1, 0, 0));
+	}
+
+	// green up to the hit, gray beyond it or for a miss
+	void debugSegment(const Line &ln, const Vec3 &hit)
+	{
+		if (!hit.valid())
+		{
+			renderDebugLine(ln.a(), ln.b(), Vec3(0.5));
+			return;
+		}
+		renderDebugLine(ln.a(), hit, Vec3(0, 1, 0));
+		renderDebugLine(hit, ln.b(), Vec3(0.5));
+		debugHit(hit);
+	}
+
+	// the axis and four lines along the surface
+	void debugCone(const Cone &cone, const Vec3 &hit)
+	{
+		const Vec3 side = normalize(cross(cone.direction, abs(cone.direction[1]) < 0.9 ? Vec3(0, 1, 0) : Vec3(1, 0, 0)));
+		const Vec3 up = cross(side, cone.direction);
+		const Real c = cos(cone.halfAngle), s = sin(cone.halfAngle);
+		const Vec3 color = Vec3(1, 1, 0);
+		renderDebugLine(cone.origin, cone.origin + cone.direction * cone.length, color);
+		for (const Vec3 &v : { side, -side, up, -up })
+			renderDebugLine(cone.origin, cone.origin + (cone.direction * c + v * s) * cone.length, color);
+		if (hit.valid())
+			debugHit(hit);
+	}
+
+	struct BatchTask
+	{
+		const TerrainCollisionWorld *world = nullptr;
+		PointerRange<const Line> segments;
+		PointerRange<TerrainRayHit> hits;
+		PointerRange<TerrainRayCache> caches;
+	};
+
+	Line toLocal(const ColliderInstance &it, const Vec3 &origin, const Vec3 &direction)
+	{
+		// the line parameters are preserved when the directions are transformed without normalization
+		Line ln;
+		ln.origin = it.inverse * origin;
+		ln.direction = it.inverse.orientation * direction * it.inverse.scale;
+		return ln;
+	}
+
+	// tests the neighbourhood of the cached triangle, a hit there resolves the ray
+	bool intersectCached(const TerrainCollisionWorld *world, RayPacket &p, uint32 i, const TerrainRayCache &cache)
+	{
+		if (!cache.tile)
+			return false;
+		const auto lt = world->leaves.find(cache.tile);
+		if (lt == world->leaves.end())
+			return false;
+		const ColliderInstance &it = world->instances[lt->second];
+		const uint32 tris = it.collider->trianglesCount();
+		if (cache.triangle >= tris)
+			return false;
+		const uint32 first = cache.triangle > CacheNeighbourhood / 2 ? cache.triangle - CacheNeighbourhood / 2 : 0;
+		const uint32 count = min(CacheNeighbourhood, tris - first);
+		const Line ln = toLocal(it, Vec3(p.origin[0][i], p.origin[1][i], p.origin[2][i]), Vec3(p.direction[0][i], p.direction[1][i], p.direction[2][i]));
+		Real dist = p.distance[i];
+		uint32 triangle = m;
+		if (!it.collider->intersection(ln.origin, ln.direction, p.minimum[i], dist, triangle, first, count))
+			return false;
+		p.distance[i] = dist.value;
+		p.triangle[i] = triangle;
+		return true;
+	}
+
+	void intersectPacket(BatchTask *task, uint32 packetIndex)
+	{
+		const uint32 first = packetIndex * RayPacket::Size;
+		RayPacket p;
+		p.count = min(numeric_cast<uint32>(task->segments.size()) - first, RayPacket::Size);
+		for (uint32 i = 0; i < p.count; i++)
+		{
+			const Line &ln = task->segments[first + i];
+			CAGE_ASSERT(ln.isSegment());
+			for (uint32 a = 0; a < 3; a++)
+			{
+				p.origin[a][i] = ln.origin[a].value;
+				p.direction[a][i] = ln.direction[a].value;
+			}
+			p.minimum[i] = ln.minimum.value;
+			p.distance[i] = ln.maximum.value;
+			p.triangle[i] = m;
+		}
+		uint32 tiles[RayPacket::Size] = {};
+		bool resolved[RayPacket::Size] = {};
+
+		const TerrainCollisionWorld *world = task->world;
+		if (!task->caches.empty())
+		{
+			uint64 queries = 0, hits = 0;
+			for (uint32 i = 0; i < p.count; i++)
+			{
+				TerrainRayCache &c = task->caches[first + i];
+				if (!c.tile)
+					continue;
+				c.queries++;
+				queries++;
+				if (intersectCached(world, p, i, c))
+				{
+					resolved[i] = true;
+					tiles[i] = c.tile;
+					c.hits++;
+					hits++;
+				}
+			}
+			cacheQueries += queries;
+			cacheHits += hits;
+		}
+
+		// the full traversal only for the rays not resolved by their caches
+		RayPacket q;
+		uint32 map[RayPacket::Size] = {};
+		for (uint32 i = 0; i < p.count; i++)
+		{
+			if (resolved[i])
+				continue;
+			const uint32 k = q.count++;
+			for (uint32 a = 0; a < 3; a++)
+			{
+				q.origin[a][k] = p.origin[a][i];
+				q.direction[a][k] = p.direction[a][i];
+			}
+			q.minimum[k] = p.minimum[i];
+			q.distance[k] = p.distance[i];
+			q.triangle[k] = m;
+			map[k] = i;
+		}
+
+		if (q.count)
+		{
+			q.prepare();
+			world->tree.query([&](const Aabb &box) {
+				const float low[3] = { box.a[0].value, box.a[1].value, box.a[2].value };
+				const float high[3] = { box.b[0].value, box.b[1].value, box.b[2].value };
+				return q.intersects(low, high);
+			}, [&](uint32 leaf) {
+				const ColliderInstance &it = world->instances[leaf];
+				RayPacket local;
+				local.count = q.count;
+				for (uint32 i = 0; i < q.count; i++)
+				{
+					const Line ln = toLocal(it, Vec3(q.origin[0][i], q.origin[1][i], q.origin[2][i]), Vec3(q.direction[0][i], q.direction[1][i], q.direction[2][i]));
+					for (uint32 a = 0; a < 3; a++)
+					{
+						local.origin[a][i] = ln.origin[a].value;
+						local.direction[a][i] = ln.direction[a].value;
+					}
+					local.minimum[i] = q.minimum[i];
+					local.distance[i] = q.distance[i];
+					local.triangle[i] = m;
+				}
+				if (!it.collider->intersection(local))
+					return;
+				for (uint32 i = 0; i < q.count; i++)
+				{
+					if (local.triangle[i] == m)
+						continue;
+					q.distance[i] = local.distance[i];
+					q.triangle[i] = local.triangle[i];
+					tiles[map[i]] = it.name;
+				}
+			});
+			for (uint32 i = 0; i < q.count; i++)
+			{
+				p.distance[map[i]] = q.distance[i];
+				p.triangle[map[i]] = q.triangle[i];
+			}
+		}
+
+		for (uint32 i = 0; i < p.count; i++)
+		{
+			if (!task->caches.empty())
+			{
+				TerrainRayCache &c = task->caches[first + i];
+				c.tile = tiles[i];
+				c.triangle = p.triangle[i];
+			}
+			TerrainRayHit &h = task->hits[first + i];
+			h = TerrainRayHit();
+			if (p.triangle[i] == m)
+				continue;
+			const Line &ln = task->segments[first + i];
+			h.point = ln.origin + ln.direction * p.distance[i];
+			h.tile = tiles[i];
+			h.triangle = p.triangle[i];
+		}
+	}
+
+	void pushCommand(CollisionCommand &&cmd)
+	{
+		if (stopping)
+			return;
+		ScopeLock<Mutex> lock(commandsMutex);
+		if (commands.empty())
+			commandsSemaphore->unlock();
+		commands.push_back(std::move(cmd));
+	}
+
+	CollisionCommand duplicate(const CollisionCommand &c)
+	{
+		CollisionCommand r;
+		r.name = c.name;
+		if (c.instance.collider)
+			r.instance.collider = c.instance.collider.share();
+		r.instance.transform = c.instance.transform;
+		r.instance.inverse = c.instance.inverse;
+		r.instance.box = c.instance.box;
+		r.instance.name = c.instance.name;
+		return r;
+	}
+
+	void maintenanceEntry()
+	{
+		std::vector<CollisionCommand> cmds;
+		std::vector<CollisionCommand> replay; // applied to the front buffer, not yet to the back buffer
+		uint32 back = 0;
+		while (true)
+		{
+			commandsSemaphore->lock();
+			if (stopping)
+				break;
+			{
+				ScopeLock<Mutex> lock(commandsMutex);
+				std::swap(cmds, commands);
+			}
+			if (cmds.empty())
+				continue;
+
+			releasedSemaphore->lock(); // wait for the queries still using the back buffer
+			FLITTERMOUSE_PROFILE("collision update");
+			TerrainCollisionWorld &world = worlds[back];
+			for (CollisionCommand &c : replay)
+				world.apply(std::move(c));
+			replay.clear();
+			for (CollisionCommand &c : cmds)
+			{
+				replay.push_back(duplicate(c));
+				world.apply(std::move(c));
+			}
+			cmds.clear();
+
+			Holder<TerrainCollisionSnapshot> s = systemMemory().createHolder<TerrainCollisionSnapshot>();
+			s->world = &world;
+			Holder<const TerrainCollisionSnapshot> prev = std::move(s);
+			{
+				ScopeLock<Mutex> lock(snapshotMutex);
+				std::swap(published, prev);
+			}
+			// the previous snapshot returns its token here, or when the last query using it is destroyed
+			prev.clear();
+			back = 1 - back;
+		}
+	}
 
 	void engineInitialize()
 	{
-		collisionSearchData = newCollisionStructure({});
-		collisionSearchQuery = newCollisionQuery(collisionSearchData.share());
+		commandsMutex = newMutex();
+		commandsSemaphore = newSemaphore(0, 2);
+		releasedSemaphore = newSemaphore(2, 2);
+		snapshotMutex = newMutex();
+		maintenanceThread = newThread(Delegate<void()>().bind<&maintenanceEntry>(), "collision maintenance");
 	}
 
-	void engineUpdate()
+	void engineFinalize()
 	{
-		// nothing?
+		stopping = true;
+		commandsSemaphore->unlock();
+		maintenanceThread.clear();
+		commands.clear();
+		published.clear();
 	}
 
 	class Callbacks
 	{
-		EventListener<void()> engineInitListener;
-		EventListener<void()> engineUpdateListener;
+		EventListener<void()> engineInitializeListener;
+		EventListener<void()> engineFinalizeListener;
 	public:
 		Callbacks()
 		{
-			engineInitListener.attach(controlThread().initialize);
-			engineInitListener.bind<&engineInitialize>();
-			engineUpdateListener.attach(controlThread().update);
-			engineUpdateListener.bind<&engineUpdate>();
+			engineInitializeListener.attach(controlThread().initialize);
+			engineInitializeListener.bind<&engineInitialize>();
+			engineFinalizeListener.attach(controlThread().finalize);
+			engineFinalizeListener.bind<&engineFinalize>();
 		}
 	} callbacksInstance;
 }
 
-void renderDebugRay(const Line &ln, const Vec3 &color, uint32 duration)
+TerrainCollisionQuery::TerrainCollisionQuery()
+{
+	update();
+}
+
+TerrainCollisionQuery::~TerrainCollisionQuery()
+{}
+
+void TerrainCollisionQuery::update()
 {
-	CAGE_ASSERT(ln.normalized());
-	Entity *e = engineEntities()->createAnonymous();
-	TimeoutComponent &to = e->value<TimeoutComponent>();
-	to.ttl = duration;
-	RenderComponent &r = e->value<RenderComponent>();
-	r.object = HashString("flittermouse/laser/laser.obj");
-	r.color = color;
-	TransformComponent &t = e->value<TransformComponent>();
-	t.position = ln.origin;
-	t.orientation = Quat(ln.direction, Vec3(0, 0, 1));
-	t.scale = ln.maximum;
+	Holder<const TerrainCollisionSnapshot> s;
+	if (snapshotMutex)
+	{
+		ScopeLock<Mutex> lock(snapshotMutex);
+		if (published)
+			s = published.share();
+	}
+	snapshot = std::move(s);
 }
 
-Vec3 terrainIntersection(const Line &ln)
+Vec3 TerrainCollisionQuery::intersection(const Line &ln) const
 {
 	CAGE_ASSERT(ln.isSegment());
-	if (!collisionSearchQuery->query(ln))
+	if (!snapshot)
 		return Vec3::Nan();
-	CAGE_ASSERT(collisionSearchQuery->collisionPairs().size() >= 1);
-	Holder<const Collider> c;
-	Transform tr;
-	collisionSearchQuery->collider(c, tr);
-	Triangle t = c->triangles()[collisionSearchQuery->collisionPairs()[0].b];
-	t *= tr;
-	Vec3 r = intersection(ln, t);
-	CAGE_ASSERT(r.valid());
-	//renderDebugRay(makeSegment(ln.origin, r));
+	const TerrainCollisionWorld *world = snapshot->world;
+	Real dist = ln.maximum;
+	bool found = false;
+	world->tree.query([&](const Aabb &box) {
+		return intersects(ln, box);
+	}, [&](uint32 leaf) {
+		const ColliderInstance &it = world->instances[leaf];
+		// the line parameter is preserved when the direction is transformed without normalization
+		const Vec3 o = it.inverse * ln.origin;
+		const Vec3 d = it.inverse.orientation * ln.direction * it.inverse.scale;
+		uint32 triangle = m;
+		found = it.collider->intersection(o, d, ln.minimum, dist, triangle) || found;
+	});
+	const Vec3 r = found ? ln.origin + ln.direction * dist : Vec3::Nan();
+	CAGE_ASSERT(!found || r.valid());
+	if (confDebugRays)
+		debugSegment(ln, r);
 	return r;
 }
 
-void terrainAddCollider(uint32 name, Holder<Collider> c, const Transform &tr)
+void TerrainCollisionQuery::intersection(PointerRange<const Line> segments, PointerRange<TerrainRayHit> hits) const
 {
-	CAGE_ASSERT(tr.valid());
-	CAGE_ASSERT(c);
-	CAGE_ASSERT(c->box().valid());
-	collisionSearchData->update(name, std::move(c), tr);
-	collisionSearchNeedsRebuild = true;
+	intersection(segments, hits, {});
 }
 
-void terrainRemoveCollider(uint32 name)
+TerrainRayHit TerrainCollisionQuery::intersection(const Line &ln, TerrainRayCache &cache) const
 {
-	collisionSearchData->remove(name);
-	collisionSearchNeedsRebuild = true;
+	TerrainRayHit hit;
+	intersection({ &ln, &ln + 1 }, { &hit, &hit + 1 }, { &cache, &cache + 1 });
+	return hit;
 }
 
-void terrainRebuildColliders()
+void TerrainCollisionQuery::intersection(PointerRange<const Line> segments, PointerRange<TerrainRayHit> hits, PointerRange<TerrainRayCache> caches) const
 {
-	if (!collisionSearchNeedsRebuild)
+	CAGE_ASSERT(segments.size() == hits.size());
+	CAGE_ASSERT(caches.empty() || caches.size() == segments.size());
+	if (!snapshot)
+	{
+		for (TerrainRayHit &h : hits)
+			h = TerrainRayHit();
 		return;
-	collisionSearchNeedsRebuild = false;
-	collisionSearchData->rebuild();
+	}
+	FLITTERMOUSE_PROFILE("terrain intersection batch");
+	BatchTask task;
+	task.world = snapshot->world;
+	task.segments = segments;
+	task.hits = hits;
+	task.caches = caches;
+	const uint32 packets = numeric_cast<uint32>((segments.size() + RayPacket::Size - 1) / RayPacket::Size);
+	if (packets >= ParallelPackets)
+		tasksRunBlocking("terrain intersection batch", Delegate<void(uint32)>().bind<BatchTask *, &intersectPacket>(&task), packets);
+	else
+	{
+		for (uint32 i = 0; i < packets; i++)
+			intersectPacket(&task, i);
+	}
+	if (confDebugRays)
+	{
+		for (uint32 i = 0; i < segments.size(); i++)
+			debugSegment(segments[i], hits[i].point);
+	}
+}
+
+TerrainRayHit TerrainCollisionQuery::closestInCone(const Cone &cone) const
+{
+	TerrainRayHit hit;
+	if (!snapshot)
+		return hit;
+	const TerrainCollisionWorld *world = snapshot->world;
+	Real best = cone.length;
+	Cone c = cone;
+	world->tree.query([&](const Aabb &box) {
+		if (distance(box, cone.origin) >= best)
+			return false;
+		c.length = best;
+		return intersects(c, box);
+	}, [&](uint32 leaf) {
+		const ColliderInstance &it = world->instances[leaf];
+		Cone local;
+		local.origin = it.inverse * cone.origin;
+		local.direction = it.inverse.orientation * cone.direction;
+		local.halfAngle = cone.halfAngle;
+		local.length = best * it.inverse.scale;
+		Real dist = local.length;
+		Vec3 p;
+		uint32 triangle = m;
+		if (!it.collider->closestInCone(local, dist, p, triangle))
+			return;
+		best = dist / it.inverse.scale;
+		hit.point = it.transform * p;
+		hit.tile = it.name;
+		hit.triangle = triangle;
+	});
+	if (confDebugRays)
+		debugCone(cone, hit.point);
+	return hit;
+}
+
+Real terrainRayCacheHitRate()
+{
+	const uint64 q = cacheQueries;
+	return q ? Real(double(cacheHits) / double(q)) : Real();
+}
+
+void terrainAddCollider(uint32 name, Holder<const TileCollider> c, const Transform &tr)
+{
+	CAGE_ASSERT(tr.valid());
+	CAGE_ASSERT(c);
+	CAGE_ASSERT(c->box().valid());
+	CollisionCommand cmd;
+	cmd.name = name;
+	ColliderInstance &inst = cmd.instance;
+	inst.name = name;
+	inst.box = c->box() * tr;
+	inst.collider = std::move(c);
+	inst.transform = tr;
+	inst.inverse = inverse(tr);
+	pushCommand(std::move(cmd));
+}
+
+void terrainRemoveCollider(uint32 name)
+{
+	CollisionCommand cmd;
+	cmd.name = name;
+	pushCommand(std::move(cmd));
 }
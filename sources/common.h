@@ -5,26 +5,137 @@
 
 namespace cage
 {
-	class Collider;
 	class EntityGroup;
 }
 
 using namespace cage;
 
-void renderDebugRay(const Line &ln, const Vec3 &color = Vec3(), uint32 duration = 1);
+struct TileCollider;
+struct TerrainCollisionSnapshot;
 
-Vec3 terrainIntersection(const Line &ln);
-void terrainAddCollider(uint32 name, Holder<Collider> c, const Transform &tr);
+// debug lines are drawn for a single frame, callable from any thread
+void renderDebugLine(const Vec3 &a, const Vec3 &b, const Vec3 &color = Vec3(1));
+void renderDebugRay(const Line &ln, const Vec3 &color = Vec3(1)); // the line must be finite
+
+struct TerrainRayHit
+{
+	Vec3 point = Vec3::Nan(); // nan when there is no hit
+	uint32 tile = 0; // name of the tile collider
+	uint32 triangle = m; // index of the triangle in the tile collider
+};
+
+// remembers the last hit of a caller whose rays change only slightly between frames
+// the neighbourhood of the cached triangle is tested first, and a hit there is returned without the full traversal
+// a closer surface outside of the neighbourhood is missed, the caller accepts that by passing the cache
+// a miss in the neighbourhood falls back to the full traversal and refills the cache
+struct TerrainRayCache
+{
+	uint32 tile = 0; // zero when empty
+	uint32 triangle = m;
+	uint64 queries = 0;
+	uint64 hits = 0; // the neighbourhood contained a hit, the traversal was skipped
+
+	Real hitRate() const { return queries ? Real(double(hits) / double(queries)) : Real(); }
+};
+
+// colliders changes are applied on a background thread and published as immutable snapshots
+// each thread makes its own query object, which keeps the snapshot alive until updated or destroyed
+// the world is double buffered, so long lived queries delay the publishing of further changes
+class TerrainCollisionQuery
+{
+public:
+	TerrainCollisionQuery(); // uses the latest snapshot
+	~TerrainCollisionQuery();
+	void update(); // switch to the latest snapshot
+	Vec3 intersection(const Line &ln) const;
+
+	// segments are processed in packets, consecutive segments should be coherent (similar origins and directions)
+	// large batches are split between multiple threads
+	void intersection(PointerRange<const Line> segments, PointerRange<TerrainRayHit> hits) const;
+
+	// caches are optional, one per segment
+	TerrainRayHit intersection(const Line &ln, TerrainRayCache &cache) const;
+	void intersection(PointerRange<const Line> segments, PointerRange<TerrainRayHit> hits, PointerRange<TerrainRayCache> caches) const;
+
+	// closest point on the terrain to the cone origin, that lies inside the cone and closer than the cone length
+	// the cone direction must be normalized and the half angle less than 90 degrees
+	TerrainRayHit closestInCone(const Cone &cone) const;
+
+private:
+	Holder<const TerrainCollisionSnapshot> snapshot;
+};
+
+Real terrainRayCacheHitRate(); // accumulated over all caches
+
+// the analytic terrain density, the surface is at zero
+Real terrainDensity(const Vec3 &position);
+
+// intersection by sphere tracing the density field directly, independent of the streamed colliders
+// it finds the analytic isosurface, the meshed tiles deviate from it by up to their cell size (several world units for distant tiles)
+Vec3 terrainIntersectionField(const Line &ln);
+bool terrainFieldEnabled(); // long probes use the field instead of the colliders
+void terrainAddCollider(uint32 name, Holder<const TileCollider> c, const Transform &tr);
 void terrainRemoveCollider(uint32 name);
-void terrainRebuildColliders();
 
+struct LightningSegment
+{
+	Quat orientation;
+	Vec3 position;
+	Vec3 color;
+	Real length;
+	Real animationOffset;
+};
+
+// subdivides the discharge into segments facing the camera, returns number of segments written
+// independent of the engine, the output is truncated to its capacity
+uint32 lightningGenerate(const Vec3 &a, const Vec3 &b, const Vec3 &cam, const Vec3 &color, RandomGenerator &rng, PointerRange<LightningSegment> output);
+// segments are kept for a configured number of ticks and rendered with pooled entities
+// must be called on the control thread
+void lightningDischarge(const Vec3 &a, const Vec3 &b, const Vec3 &cam, const Vec3 &color);
+void lightningSubmit(PointerRange<const LightningSegment> segments, const Vec3 &light, const Vec3 &color); // pre-generated segments
+
+// transform hierarchy, world transforms are propagated once per tick
+// a root follows the transform of the named entity, the other nodes overwrite the transform of their entity
+// nodes live until the engine finalizes
+uint32 attachmentRoot(uint32 entityName);
+uint32 attachmentCreate(Entity *e, uint32 parent, const Transform &local); // the parent must already exist, the entity must have a name
+// destroying an attached entity is allowed, its node keeps propagating to its children
+const Transform &attachmentWorld(uint32 node); // as of the last propagation
+
+// added by timeoutSchedule, do not add directly
 struct TimeoutComponent
 {
-	uint32 ttl = 10;
+	uint64 expiry = 0; // absolute tick
 };
 
+// the entity is destroyed after ttl ticks, scheduling again replaces the previous timeout
+// the entity must have a name
+// intended for sparse long lived effects, high frequency effects (lightning, debug lines) pool their entities and expire their data themselves
+void timeoutSchedule(Entity *e, uint32 ttl);
+
+struct TerrainStreamingStatistics
+{
+	uint32 queueGenerate = 0;
+	uint32 queueUpload = 0;
+	uint32 queueColliders = 0;
+	uint32 freeSlots = 0;
+	uint32 generatorsActive = 0;
+	Real generatorsUtilization;
+	Real latency[3]; // request to ready, p50, p95 and p99, milliseconds
+};
+TerrainStreamingStatistics terrainStreamingStatistics();
+
 extern EntityGroup *entitiesToDestroy;
+// control thread only, other threads use the snapshot
 extern Vec3 playerPosition;
+extern Real playerViewScale; // screen pixels per world unit at unit distance from the camera
+
+struct PlayerView
+{
+	Vec3 position;
+	Real viewScale = 1000;
+};
+PlayerView playerViewSnapshot(); // consistent copy from the last control tick, thread safe
 extern Real terrainGenerationProgress;
 
 #endif
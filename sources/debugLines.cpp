@@ -0,0 +1,315 @@
+#include "common.h"
+#include "profiler.h"
+#include "tickBudget.h"
+#include "frameArena.h"
+
+#include <cage-core/entities.h>
+#include <cage-core/geometry.h>
+#include <cage-core/concurrent.h>
+#include <cage-core/assetManager.h>
+#include <cage-core/mesh.h>
+#include <cage-core/meshImport.h>
+#include <cage-engine/scene.h>
+#include <cage-engine/model.h>
+#include <cage-engine/assetStructs.h>
+#include <cage-simple/engine.h>
+
+#include <array>
+#include <atomic>
+#include <vector>
+
+namespace
+{
+	constexpr uint32 LinesCapacity = 65536;
+	constexpr uint32 ColorsCapacity = 16; // lines with more distinct colors are drawn with the last one
+
+	struct DebugLine
+	{
+		Vec3 a, b;
+		Vec3 color;
+	};
+
+	// writers reserve a slot with a single atomic increment
+	// the control thread swaps the buffers once per frame and waits for writers that still use the old one
+	struct LinesBuffer
+	{
+		std::vector<DebugLine> lines = std::vector<DebugLine>(LinesCapacity);
+		std::atomic<uint32> count {0};
+		std::atomic<uint32> writers {0};
+	};
+
+	std::array<LinesBuffer, 2> buffers;
+	std::atomic<uint32> current {0};
+
+	struct Batch
+	{
+		Holder<Mesh> mesh;
+		Vec3 color;
+		uint32 name = 0;
+	};
+
+	// a set of batches that belongs to one frame of lines
+	// fixed capacity, so that moving frames between the threads does not allocate
+	struct Frame
+	{
+		std::array<Batch, ColorsCapacity> storage;
+		uint32 count = 0;
+		uint64 generation = 0;
+
+		PointerRange<Batch> batches() { return { storage.data(), storage.data() + count }; }
+		PointerRange<const Batch> batches() const { return { storage.data(), storage.data() + count }; }
+	};
+
+	// the control thread publishes the batches, the dispatch thread fabricates their models and hands them back
+	// the entities switch to the new models only once they are loaded, and the previous models are removed afterwards
+	Holder<Mutex> framesMutex;
+	Frame pending; // waiting for the dispatch thread
+	Frame ready; // fabricated, waiting for the control thread
+	Frame shown; // control thread only
+	uint64 generation = 0; // control thread only
+	std::vector<Holder<Mesh>> meshesPool; // returned by the dispatch thread once converted into models
+	std::vector<Entity *> entities;
+
+	// framesMutex must be locked
+	void recycleMeshes(Frame &f)
+	{
+		for (Batch &b : f.batches())
+			if (b.mesh)
+				meshesPool.push_back(std::move(b.mesh));
+	}
+
+	Holder<Mesh> takeMesh()
+	{
+		{
+			ScopeLock<Mutex> lock(framesMutex);
+			if (!meshesPool.empty())
+			{
+				Holder<Mesh> mesh = std::move(meshesPool.back());
+				meshesPool.pop_back();
+				mesh->clear();
+				return mesh;
+			}
+		}
+		return newMesh();
+	}
+
+	void removeModels(const Frame &f)
+	{
+		AssetManager *ass = engineAssets();
+		for (const Batch &b : f.batches())
+			ass->remove(b.name);
+	}
+
+	bool modelsLoaded(const Frame &f)
+	{
+		AssetManager *ass = engineAssets();
+		for (const Batch &b : f.batches())
+			if (!ass->get<AssetSchemeIndexModel, Model>(b.name))
+				return false;
+		return true;
+	}
+
+	void showFrame(Frame &&f)
+	{
+		removeModels(shown);
+		shown = std::move(f);
+
+		// one entity per color
+		while (entities.size() < shown.count)
+			entities.push_back(engineEntities()->createAnonymous());
+		for (uint32 k = 0; k < entities.size(); k++)
+		{
+			Entity *e = entities[k];
+			if (k < shown.count)
+			{
+				e->value<TransformComponent>();
+				RenderComponent &r = e->value<RenderComponent>();
+				r.object = shown.storage[k].name;
+				r.color = shown.storage[k].color;
+			}
+			else
+				e->remove<RenderComponent>();
+		}
+	}
+
+	TickBudget tickBudget("debug lines");
+
+	void engineUpdate()
+	{
+		TickBudgetScope budgetScope(tickBudget);
+		FLITTERMOUSE_PROFILE("debug lines update");
+		generation++;
+
+		// take over the models fabricated since the last tick
+		{
+			ScopeLock<Mutex> lock(framesMutex);
+			if (ready.count)
+			{
+				if (ready.generation < shown.generation)
+				{
+					// an empty frame was shown meanwhile
+					removeModels(ready);
+					ready = Frame();
+				}
+				else if (modelsLoaded(ready))
+				{
+					showFrame(std::move(ready));
+					ready = Frame();
+				}
+			}
+		}
+
+		// swap the buffers
+		const uint32 prev = current.fetch_xor(1);
+		LinesBuffer &buf = buffers[prev];
+		while (buf.writers > 0)
+			threadYield();
+		const uint32 cnt = min(uint32(buf.count), LinesCapacity);
+		buf.count = 0;
+
+		if (cnt == 0)
+		{
+			// an empty frame hides the lines immediately, nothing needs to be fabricated
+			{
+				ScopeLock<Mutex> lock(framesMutex);
+				recycleMeshes(pending);
+				pending = Frame(); // its names were never used for an asset
+			}
+			if (shown.count)
+				showFrame(Frame());
+			shown.generation = generation; // fabricated frames older than this are discarded
+			return;
+		}
+
+		// group by color
+		Frame frame;
+		frame.generation = generation;
+		FrameVector<FrameVector<Vec3>> positions;
+		for (uint32 i = 0; i < cnt; i++)
+		{
+			const DebugLine &l = buf.lines[i];
+			uint32 k = 0;
+			while (k < frame.count && frame.storage[k].color != l.color)
+				k++;
+			if (k == frame.count)
+			{
+				if (frame.count < ColorsCapacity)
+				{
+					frame.storage[frame.count++].color = l.color;
+					positions.emplace_back();
+				}
+				else
+					k--;
+			}
+			positions[k].push_back(l.a);
+			positions[k].push_back(l.b);
+		}
+
+		AssetManager *ass = engineAssets();
+		for (uint32 k = 0; k < frame.count; k++)
+		{
+			Batch &b = frame.storage[k];
+			b.mesh = takeMesh();
+			b.mesh->type(MeshTypeEnum::Lines);
+			b.mesh->positions(positions[k]);
+			b.name = ass->generateUniqueName();
+		}
+
+		{
+			ScopeLock<Mutex> lock(framesMutex);
+			recycleMeshes(pending);
+			pending = std::move(frame); // a frame not yet dispatched is dropped, its names were never used for an asset
+		}
+	}
+
+	void engineDispatch()
+	{
+		FLITTERMOUSE_PROFILE("debug lines dispatch");
+		Frame frame;
+		{
+			ScopeLock<Mutex> lock(framesMutex);
+			std::swap(frame, pending);
+		}
+		if (frame.count == 0)
+			return; // keep the current models until a newer frame replaces them
+
+		AssetManager *ass = engineAssets();
+		for (Batch &b : frame.batches())
+		{
+			Holder<Model> m = newModel();
+			MeshImportMaterial mat;
+			mat.albedoBase = Vec4(1);
+			m->importMesh(+b.mesh, bufferView(mat));
+			m->flags = MeshRenderFlags::DepthTest | MeshRenderFlags::DepthWrite; // unlit
+			ass->fabricate<AssetSchemeIndexModel, Model>(b.name, std::move(m), "debug lines");
+		}
+
+		ScopeLock<Mutex> lock(framesMutex);
+		recycleMeshes(frame);
+		removeModels(ready); // never shown, superseded by this frame
+		ready = std::move(frame);
+	}
+
+	void engineInitialize()
+	{
+		framesMutex = newMutex();
+	}
+
+	void engineFinalize()
+	{
+		entities.clear();
+		ScopeLock<Mutex> lock(framesMutex);
+		pending = Frame();
+		ready = Frame();
+		shown = Frame();
+		meshesPool.clear();
+	}
+
+	class Callbacks
+	{
+		EventListener<void()> engineInitializeListener;
+		EventListener<void()> engineFinalizeListener;
+		EventListener<void()> engineUpdateListener;
+		EventListener<void()> engineDispatchListener;
+	public:
+		Callbacks()
+		{
+			engineInitializeListener.attach(controlThread().initialize);
+			engineInitializeListener.bind<&engineInitialize>();
+			engineFinalizeListener.attach(controlThread().finalize);
+			engineFinalizeListener.bind<&engineFinalize>();
+			// after all systems that may draw lines
+			engineUpdateListener.attach(controlThread().update, 300);
+			engineUpdateListener.bind<&engineUpdate>();
+			engineDispatchListener.attach(graphicsDispatchThread().dispatch);
+			engineDispatchListener.bind<&engineDispatch>();
+		}
+	} callbacksInstance;
+}
+
+void renderDebugLine(const Vec3 &a, const Vec3 &b, const Vec3 &color)
+{
+	while (true)
+	{
+		const uint32 index = current;
+		LinesBuffer &buf = buffers[index];
+		buf.writers++;
+		if (current != index)
+		{
+			// swapped meanwhile, retry with the other buffer
+			buf.writers--;
+			continue;
+		}
+		const uint32 slot = buf.count++;
+		if (slot < LinesCapacity)
+			buf.lines[slot] = { a, b, color };
+		buf.writers--;
+		return;
+	}
+}
+
+void renderDebugRay(const Line &ln, const Vec3 &color)
+{
+	CAGE_ASSERT(ln.normalized() && ln.minimum.finite() && ln.maximum.finite());
+	renderDebugLine(ln.a(), ln.b(), color);
+}
@@ -1,15 +1,19 @@
 #include "common.h"
+#include "profiler.h"
+#include "tickBudget.h"
 
 #include <cage-core/ini.h>
 #include <cage-core/entities.h>
 #include <cage-core/geometry.h>
 #include <cage-core/hashString.h>
 #include <cage-core/string.h>
+#include <cage-core/tasks.h>
 #include <cage-engine/scene.h>
 #include <cage-engine/sceneScreenSpaceEffects.h>
 #include <cage-simple/engine.h>
 
 #include <cstring> // std::strlen
+#include <vector>
 
 namespace
 {
@@ -126,44 +130,34 @@ namespace
 {
 	struct MagnetComponent
 	{
-		Transform model;
 		Vec3 target;
+		TerrainRayCache cache; // for the probe towards the target
+		uint32 attachment = m;
 	};
 
 	struct LightComponent
 	{
-		Transform model;
 		Vec3 target;
+		TerrainRayCache cache;
+		uint32 attachment = m;
 	};
 
-	struct GunMuzzleComponent
+	void createMagnet(uint32 ship, const Transform &model)
 	{
-		Transform model;
-	};
-
-	struct GunTowerComponent
-	{
-		Entity *muzzle = nullptr;
-	};
-
-	void createMagnet(const Vec3 &position, const Quat &orientation)
-	{
-		Entity *e = engineEntities()->createAnonymous();
+		Entity *e = engineEntities()->createUnique();
 		MagnetComponent &t = e->value<MagnetComponent>();
-		t.model.position = position;
-		t.model.orientation = orientation;
-		t.target = t.model.position + t.model.orientation * Vec3(0, 0, -1);
+		t.attachment = attachmentCreate(e, ship, model);
+		t.target = model.position + model.orientation * Vec3(0, 0, -1);
 		RenderComponent &r = e->value<RenderComponent>();
 		r.object = HashString("flittermouse/player/magnet.object");
 	}
 
-	void createLight(const Vec3 &position, const Quat &orientation)
+	void createLight(uint32 ship, const Transform &model)
 	{
-		Entity *e = engineEntities()->createAnonymous();
+		Entity *e = engineEntities()->createUnique();
 		LightComponent &t = e->value<LightComponent>();
-		t.model.position = position;
-		t.model.orientation = orientation;
-		t.target = t.model.position + t.model.orientation * Vec3(0, 0, -1);
+		t.attachment = attachmentCreate(e, ship, model);
+		t.target = model.position + model.orientation * Vec3(0, 0, -1);
 		cage::LightComponent &l = e->value<cage::LightComponent>();
 		l.lightType = LightTypeEnum::Spot;
 		l.color = randomChance3() * 0.3 + 0.7;
@@ -173,166 +167,219 @@ namespace
 		s.worldSize = Vec3(0.1, 100, 0);
 	}
 
-	void createGun(const Vec3 &position, const Quat &orientation)
+	void createGun(uint32 ship, const Transform &model)
 	{
-		Entity *muzzle = nullptr;
+		uint32 muzzle = m;
 		{
-			Entity *e = muzzle = engineEntities()->createAnonymous();
-			GunMuzzleComponent &m = e->value<GunMuzzleComponent>();
-			m.model.position = position;
-			m.model.orientation = orientation;
+			Entity *e = engineEntities()->createUnique();
+			muzzle = attachmentCreate(e, ship, model);
 			RenderComponent &r = e->value<RenderComponent>();
 			r.object = HashString("flittermouse/player/muzzle.object");
 		}
 		{
-			Entity *e = engineEntities()->createAnonymous();
-			GunTowerComponent &t = e->value<GunTowerComponent>();
-			t.muzzle = muzzle;
+			Entity *e = engineEntities()->createUnique();
+			attachmentCreate(e, muzzle, Transform());
 			RenderComponent &r = e->value<RenderComponent>();
 			r.object = HashString("flittermouse/player/tower.object");
 		}
 	}
 
-	void aimAtClosestWallTarget(const Vec3 &origin, const Vec3 &initialDirection, Vec3 &target, const Rads maxDeviation, const uint32 maxAttempts, const Real maxReach)
+	// target is the closest terrain point inside the cone, or the far end of the axis
+	// the probe is a terrain point inside the cone, if any, it bounds the length of the cone
+	Vec3 aimAtClosestWallTarget(const TerrainCollisionQuery &query, const Vec3 &origin, const Vec3 &initialDirection, const Rads maxDeviation, const Real maxReach, const Vec3 &probe)
 	{
-		const Real maxDeviDot = cos(maxDeviation);
+		Cone cone;
+		cone.origin = origin;
+		cone.direction = initialDirection;
+		cone.halfAngle = maxDeviation;
+		cone.length = probe.valid() ? min(distance(origin, probe), maxReach) : maxReach;
+		const TerrainRayHit hit = query.closestInCone(cone);
+		const Vec3 target = hit.point.valid() ? hit.point : probe.valid() ? probe : origin + initialDirection * maxReach;
+		CAGE_ASSERT(target.valid() && distance(origin, target) < maxReach + 1e-5);
+		return target;
+	}
 
-		const auto &check = [&](const Vec3 &p) -> bool
+	// each magnet and light is updated by an independent task
+	// tasks only read their inputs and write their outputs, which are applied to the entities afterwards
+
+	struct DoodadJob
+	{
+		Transform world;
+		Vec3 camera;
+		const TerrainCollisionQuery *query = nullptr;
+		RandomGenerator rng;
+		Entity *entity = nullptr;
+		Vec3 probe = Vec3::Nan();
+
+		Transform transform;
+		Vec3 target;
+
+		void aim(const Rads maxDeviation, const Real maxReach)
 		{
-			Real c = dot(normalize(p - origin), initialDirection);
-			return c > maxDeviDot;
-		};
+			transform = world;
+			target = aimAtClosestWallTarget(*query, transform.position, transform.orientation * Vec3(0, 0, -1), maxDeviation, maxReach, probe);
+			transform.orientation = Quat(normalize(target - transform.position), transform.orientation * Vec3(0, 1, 0));
+		}
+	};
+
+	struct MagnetJob : public DoodadJob
+	{
+		static constexpr float MaxDeviation = 40; // degrees
+		static constexpr float MaxReach = 3;
+
+		std::vector<LightningSegment> segments = std::vector<LightningSegment>(1024);
+		uint32 segmentsCount = 0;
+		Vec3 color;
+
+		void operator() ()
+		{
+			aim(Degs(MaxDeviation), MaxReach);
+			discharge();
+		}
 
-		const auto &reposition = [&](const Vec3 &p) -> Vec3
+		void discharge()
 		{
-			Vec3 t = origin + normalize(p - origin) * maxReach;
-			Vec3 q = terrainIntersection(makeSegment(origin, t));
-			return q.valid() ? q : t;
-		};
+			segmentsCount = 0;
+			if (rng.randomChance() > 0.3 / (1 + sqr(distanceSquared(target, transform.position))))
+				return;
+			color = rng.randomChance3() * 0.4 + Vec3(0, 0, 0.4);
+			const Vec3 start = transform.position + transform.orientation * Vec3(0, 0, -0.005);
+			const Vec3 end = target + (rng.randomChance3() - 0.5) * 0.01;
+			segmentsCount = lightningGenerate(start, end, camera, color, rng, segments);
+		}
+
+		void apply()
+		{
+			entity->value<TransformComponent>() = transform;
+			entity->value<MagnetComponent>().target = target;
+			if (segmentsCount)
+				lightningSubmit({ segments.data(), segments.data() + segmentsCount }, (transform.position + target) * 0.5, color);
+		}
+	};
+
+	struct LightJob : public DoodadJob
+	{
+		static constexpr float MaxDeviation = 15; // degrees
+		static constexpr float MaxReach = 12;
 
-		CAGE_ASSERT(check(target));
-		target = reposition(target);
+		void operator() ()
+		{
+			aim(Degs(MaxDeviation), MaxReach);
+		}
 
+		void apply(ScreenSpaceEffectsComponent &cameraProperties)
 		{
-			Vec3 p = origin + initialDirection;
-			p = reposition(p);
-			if (distanceSquared(origin, p) < distanceSquared(origin, target))
-				target = p;
+			entity->value<TransformComponent>() = transform;
+			entity->value<LightComponent>().target = target;
+			cage::LightComponent &ll = entity->value<cage::LightComponent>();
+			ll.intensity = interpolate(ll.intensity, sqr(distance(target, transform.position) + 1), 0.02);
+			const Real focus = distance(camera, target);
+			cameraProperties.depthOfField.focusDistance = interpolate(cameraProperties.depthOfField.focusDistance, focus, 0.05);
 		}
+	};
+
+	std::vector<MagnetJob> magnetJobs;
+	std::vector<LightJob> lightJobs;
 
-		for (uint32 attempt = 0; attempt < maxAttempts; attempt++)
+	template<class Job, class Component>
+	void prepareJobs(std::vector<Job> &jobs, const TerrainCollisionQuery &query, const Vec3 &camera)
+	{
+		const auto ents = engineEntities()->component<Component>()->entities();
+		jobs.resize(ents.size());
+		for (uint32 i = 0; i < jobs.size(); i++)
 		{
-			Vec3 p = target + randomDirection3() * 0.1;
-			if (!check(p))
-				continue;
-			p = reposition(p);
-			if (distanceSquared(origin, p) < distanceSquared(origin, target))
-				target = p;
+			Job &j = jobs[i];
+			j.entity = ents[i];
+			j.world = attachmentWorld(ents[i]->template value<Component>().attachment);
+			j.camera = camera;
+			j.query = &query;
+			j.rng = RandomGenerator(detail::randomGenerator().next(), detail::randomGenerator().next());
 		}
-		CAGE_ASSERT(target.valid() && check(target) && distance(origin, target) < maxReach + 1e-5);
 	}
 
-	void magnetDischargeImpl(const Vec3 &a, const Vec3 &b, const Vec3 &cam, const Vec3 &color, Real lightProb)
+	// rays towards the previous targets of all doodads, cast together in one batch with their temporal caches
+	// a hit bounds the cone search, which then culls most of the terrain
+	std::vector<Line> probeSegments;
+	std::vector<TerrainRayHit> probeHits;
+	std::vector<TerrainRayCache> probeCaches;
+
+	template<class Job, class Component>
+	void addProbes(const std::vector<Job> &jobs)
 	{
-		Real d = distance(a, b);
-		Vec3 v = normalize(b - a);
-		Vec3 c = (a + b) * 0.5;
-		Vec3 up = normalize(cam - c);
-#ifdef CAGE_DEBUG
-		constexpr Real threshold = 0.15;
-#else
-		constexpr Real threshold = 0.03;
-#endif // CAGE_DEBUG
-		if (d > threshold)
+		for (const Job &j : jobs)
 		{
-			Vec3 side = normalize(cross(v, up));
-			c += side * (d * randomRange(-0.2, 0.2));
-			magnetDischargeImpl(a, c, cam, color, lightProb * 0.5);
-			magnetDischargeImpl(c, b, cam, color, lightProb * 0.5);
-			return;
+			const Component &c = j.entity->template value<Component>();
+			const Vec3 axis = j.world.orientation * Vec3(0, 0, -1);
+			Vec3 dir = c.target - j.world.position;
+			if (lengthSquared(dir) < 1e-10 || dot(normalize(dir), axis) < cos(Degs(Job::MaxDeviation)))
+				dir = axis; // the previous target has left the cone
+			probeSegments.push_back(makeSegment(j.world.position, j.world.position + normalize(dir) * Job::MaxReach));
+			probeCaches.push_back(c.cache);
 		}
-		Entity *e = engineEntities()->createUnique();
-		TransformComponent &t = e->value<TransformComponent>();
-		t.position = c;
-		t.orientation = Quat(v, up, true);
-		t.scale = d;
-		RenderComponent &r = e->value<RenderComponent>();
-		r.object = HashString("flittermouse/lightning/lightning.obj");
-		r.color = color;
-		TextureAnimationComponent &anim = e->value<TextureAnimationComponent>();
-		anim.offset = randomChance() * 100;
-		TimeoutComponent &ttl = e->value<TimeoutComponent>();
-		ttl.ttl = 1;
-		if (randomChance() < lightProb)
+	}
+
+	template<class Job, class Component>
+	void takeProbes(std::vector<Job> &jobs, uint32 &offset)
+	{
+		for (Job &j : jobs)
 		{
-			cage::LightComponent &light = e->value<cage::LightComponent>();
-			light.color = color;
-			light.intensity = 1.5;
-			light.lightType = LightTypeEnum::Point;
-			light.attenuation = Vec3(0.5, 0, 0.4);
+			j.probe = probeHits[offset].point;
+			j.entity->template value<Component>().cache = probeCaches[offset];
+			offset++;
 		}
 	}
 
-	void magnetDischarge(const Transform &tc, const Vec3 &pc)
+	void castProbes(const TerrainCollisionQuery &query)
 	{
-		if (randomChance() > 0.3 / (1 + sqr(distanceSquared(pc, tc.position))))
-			return;
-		Vec3 color = randomChance3() * 0.4 + Vec3(0, 0, 0.4);
-		TransformComponent &cam = engineEntities()->get(1)->value<TransformComponent>();
-		Vec3 start = tc.position + tc.orientation * Vec3(0, 0, -0.005);
-		Vec3 end = pc + (randomChance3() - 0.5) * 0.01;
-		magnetDischargeImpl(start, end, cam.position, color, 2);
+		FLITTERMOUSE_PROFILE("doodads probes");
+		probeSegments.clear();
+		probeCaches.clear();
+		addProbes<MagnetJob, MagnetComponent>(magnetJobs);
+		addProbes<LightJob, LightComponent>(lightJobs);
+		probeHits.resize(probeSegments.size());
+		if (terrainFieldEnabled())
+		{
+			// the field finds the surface also in tiles without colliders yet
+			for (uint32 i = 0; i < probeSegments.size(); i++)
+			{
+				probeHits[i] = TerrainRayHit();
+				probeHits[i].point = terrainIntersectionField(probeSegments[i]);
+			}
+		}
+		else
+			query.intersection(probeSegments, probeHits, probeCaches);
+		uint32 offset = 0;
+		takeProbes<MagnetJob, MagnetComponent>(magnetJobs, offset);
+		takeProbes<LightJob, LightComponent>(lightJobs, offset);
 	}
 
+	TickBudget tickBudget("doodads");
+
 	void engineUpdate()
 	{
+		TickBudgetScope budgetScope(tickBudget);
 		if (!engineEntities()->has(10))
 			return;
+		FLITTERMOUSE_PROFILE("doodads update");
 
-		TransformComponent &p = engineEntities()->get(10)->value<TransformComponent>();
 		TransformComponent &cameraTransform = engineEntities()->get(1)->value<TransformComponent>();
 		ScreenSpaceEffectsComponent &cameraProperties = engineEntities()->get(1)->value<ScreenSpaceEffectsComponent>();
 
-		for (Entity *e : engineEntities()->component<MagnetComponent>()->entities())
 		{
-			MagnetComponent &m = e->value<MagnetComponent>();
-			TransformComponent &t = e->value<TransformComponent>();
-			t = p * m.model;
-			aimAtClosestWallTarget(t.position, t.orientation * Vec3(0, 0, -1), m.target, Degs(40), 1, 3);
-			t.orientation = Quat(normalize(m.target - t.position), t.orientation * Vec3(0, 1, 0));
-			magnetDischarge(t, m.target);
+			const TerrainCollisionQuery query; // one snapshot shared by all tasks
+			prepareJobs<MagnetJob, MagnetComponent>(magnetJobs, query, cameraTransform.position);
+			prepareJobs<LightJob, LightComponent>(lightJobs, query, cameraTransform.position);
+			castProbes(query);
+			tasksRunBlocking<MagnetJob>("magnets", magnetJobs);
+			tasksRunBlocking<LightJob>("lights", lightJobs);
 		}
 
-		for (Entity *e : engineEntities()->component<LightComponent>()->entities())
-		{
-			LightComponent &l = e->value<LightComponent>();
-			TransformComponent &t = e->value<TransformComponent>();
-			t = p * l.model;
-			aimAtClosestWallTarget(t.position, t.orientation * Vec3(0, 0, -1), l.target, Degs(15), 5, 12);
-			t.orientation = Quat(normalize(l.target - t.position), t.orientation * Vec3(0, 1, 0));
-			cage::LightComponent &ll = e->value<cage::LightComponent>();
-			ll.intensity = interpolate(ll.intensity, sqr(distance(l.target, t.position) + 1), 0.02);
-			const Real focus = distance(cameraTransform.position, l.target);
-			cameraProperties.depthOfField.focusDistance = interpolate(cameraProperties.depthOfField.focusDistance, focus, 0.05);
-		}
+		for (MagnetJob &j : magnetJobs)
+			j.apply();
+		for (LightJob &j : lightJobs)
+			j.apply(cameraProperties);
 		cameraProperties.depthOfField.focusRadius = 1;
 		cameraProperties.depthOfField.blendRadius = cameraProperties.depthOfField.focusDistance * 1.2;
-
-		for (Entity *e : engineEntities()->component<GunMuzzleComponent>()->entities())
-		{
-			GunMuzzleComponent &gm = e->value<GunMuzzleComponent>();
-			TransformComponent &t = e->value<TransformComponent>();
-			t = p * gm.model;
-		}
-
-		for (Entity *e : engineEntities()->component<GunTowerComponent>()->entities())
-		{
-			GunTowerComponent &gt = e->value<GunTowerComponent>();
-			TransformComponent &gm = gt.muzzle->value<TransformComponent>();
-			TransformComponent &t = e->value<TransformComponent>();
-			t = gm;
-			t.orientation = Quat(t.orientation * Vec3(0, 0, -1), t.orientation * Vec3(0, 1, 0), true);
-		}
 	}
 
 	Vec3 convPos(const Vec3 &v)
@@ -349,20 +396,20 @@ namespace
 	{
 		engineEntities()->defineComponent(MagnetComponent());
 		engineEntities()->defineComponent(LightComponent());
-		engineEntities()->defineComponent(GunMuzzleComponent());
-		engineEntities()->defineComponent(GunTowerComponent());
 		Holder<Ini> ini = newIni();
 		ini->importBuffer({ playerDoodadsPositionsIni, playerDoodadsPositionsIni + std::strlen(playerDoodadsPositionsIni) });
+		const uint32 ship = attachmentRoot(10);
 		for (const String &s : ini->sections())
 		{
-			const Vec3 p = convPos(Vec3::parse(ini->getString(s, "pos")));
-			const Quat r = convRot(Vec3::parse(ini->getString(s, "rot")));
+			Transform model;
+			model.position = convPos(Vec3::parse(ini->getString(s, "pos")));
+			model.orientation = convRot(Vec3::parse(ini->getString(s, "rot")));
 			if (isPattern(s, "", "magnet", ""))
-				createMagnet(p, r);
+				createMagnet(ship, model);
 			else if (isPattern(s, "", "light", ""))
-				createLight(p, r);
+				createLight(ship, model);
 			else if (isPattern(s, "", "cannon", ""))
-				createGun(p, r);
+				createGun(ship, model);
 			else
 				CAGE_THROW_ERROR(Exception, "unknown player doodad");
 		}
@@ -0,0 +1,158 @@
+#include "common.h"
+#include "profiler.h"
+#include "tickBudget.h"
+
+#include <cage-core/geometry.h>
+#include <cage-core/config.h>
+#include <cage-simple/engine.h>
+
+#include <atomic>
+#include <vector>
+
+namespace
+{
+	// use the density field instead of the colliders for the doodad probes, it reaches also into tiles that are not streamed yet
+	const ConfigBool confFieldBackend("flittermouse/collision/field/enabled", false);
+
+	// periodically casts random rays around the player with both backends and logs the differences and timings
+	const ConfigBool confFieldCompare("flittermouse/collision/field/compare", false);
+
+	// upper bound of the density gradient magnitude, per world unit
+	// value and cubic noises change by at most about 3 per lattice cell along an axis, 5.2 along the diagonal
+	// base in meshGeneratorImpl: frequency 0.12 with unit amplitude -> 0.62
+	// bumps: 3 fbm octaves at 0.4, 0.8, 1.6 with normalized amplitudes 1/1.75, 0.5/1.75, 0.25/1.75, scaled by 0.05 -> 0.18
+	// the sum is about 0.8, the default leaves a margin, the comparison reports the measured slope
+	const ConfigFloat confLipschitz("flittermouse/collision/field/lipschitz", 1);
+
+	// steps shorter than this are clamped, so features thinner than this may be skipped
+	const ConfigFloat confTolerance("flittermouse/collision/field/tolerance", 0.01);
+
+	// enough for a 20 units long segment made entirely of minimal steps
+	constexpr uint32 MaxSteps = 2000;
+	constexpr uint32 BisectionSteps = 12;
+
+	std::atomic<uint32> stepLimitHits = 0;
+
+	constexpr uint32 CompareRays = 256;
+	constexpr Real CompareReach = 12;
+	constexpr uint64 ComparePeriod = 5000000;
+	uint64 compareTime = 0;
+	std::vector<Line> compareSegments;
+	std::vector<TerrainRayHit> compareHits;
+
+	void compareBackends()
+	{
+		FLITTERMOUSE_PROFILE("field compare");
+		compareSegments.clear();
+		for (uint32 i = 0; i < CompareRays; i++)
+			compareSegments.push_back(makeSegment(playerPosition, playerPosition + randomDirection3() * CompareReach));
+		compareHits.resize(CompareRays);
+
+		const uint64 t0 = applicationTime();
+		TerrainCollisionQuery().intersection(compareSegments, compareHits);
+		const uint64 t1 = applicationTime();
+		uint32 both = 0, fieldOnly = 0, collidersOnly = 0;
+		Real sum, worst;
+		for (uint32 i = 0; i < CompareRays; i++)
+		{
+			const Vec3 f = terrainIntersectionField(compareSegments[i]);
+			const Vec3 c = compareHits[i].point;
+			if (f.valid() && c.valid())
+			{
+				both++;
+				const Real d = distance(f, c);
+				sum += d;
+				worst = max(worst, d);
+			}
+			else if (f.valid())
+				fieldOnly++;
+			else if (c.valid())
+				collidersOnly++;
+		}
+		const uint64 t2 = applicationTime();
+
+		// finite differences at random points, to validate the lipschitz bound
+		Real slope;
+		for (uint32 i = 0; i < CompareRays; i++)
+		{
+			constexpr Real H = 1e-3;
+			const Vec3 p = playerPosition + randomDirection3() * randomRange(Real(), CompareReach);
+			slope = max(slope, abs(terrainDensity(p + randomDirection3() * H) - terrainDensity(p)) / H);
+		}
+
+		CAGE_LOG(SeverityEnum::Info, "fieldIntersection", Stringizer() + "colliders: " + (t1 - t0) / CompareRays + " us/ray, field: " + (t2 - t1) / CompareRays + " us/ray");
+		CAGE_LOG(SeverityEnum::Info, "fieldIntersection", Stringizer() + "both hit: " + both + ", field only: " + fieldOnly + ", colliders only: " + collidersOnly + ", distance avg: " + (both ? sum / both : Real()) + ", max: " + worst);
+		CAGE_LOG(SeverityEnum::Info, "fieldIntersection", Stringizer() + "measured slope: " + slope + ", lipschitz bound: " + Real(confLipschitz) + ", step limit hits: " + uint32(stepLimitHits));
+		if (slope > Real(confLipschitz))
+			CAGE_LOG(SeverityEnum::Warning, "fieldIntersection", "the measured slope exceeds the lipschitz bound, the field intersections may skip the surface");
+	}
+
+	TickBudget tickBudget("field compare");
+
+	void engineUpdate()
+	{
+		TickBudgetScope budgetScope(tickBudget);
+		if (!confFieldCompare)
+			return;
+		const uint64 now = applicationTime();
+		if (now < compareTime)
+			return;
+		compareTime = now + ComparePeriod;
+		compareBackends();
+	}
+
+	class Callbacks
+	{
+		EventListener<void()> engineUpdateListener;
+	public:
+		Callbacks()
+		{
+			engineUpdateListener.attach(controlThread().update, 400);
+			engineUpdateListener.bind<&engineUpdate>();
+		}
+	} callbacksInstance;
+}
+
+Vec3 terrainIntersectionField(const Line &ln)
+{
+	CAGE_ASSERT(ln.isSegment());
+	const Real lipschitz = Real(confLipschitz);
+	const Real tolerance = Real(confTolerance);
+
+	Real t = ln.minimum;
+	Real f = terrainDensity(ln.origin + ln.direction * t);
+	const bool startSign = f > 0;
+	for (uint32 step = 0; step < MaxSteps; step++)
+	{
+		// the surface cannot be closer than the density divided by the bound of its gradient
+		const Real advance = max(abs(f) / lipschitz, tolerance);
+		const Real prevT = t;
+		t = min(t + advance, ln.maximum);
+		f = terrainDensity(ln.origin + ln.direction * t);
+		if ((f > 0) != startSign)
+		{
+			// refine the crossing by bisection
+			Real a = prevT, b = t;
+			for (uint32 i = 0; i < BisectionSteps; i++)
+			{
+				const Real c = (a + b) * 0.5;
+				if ((terrainDensity(ln.origin + ln.direction * c) > 0) == startSign)
+					a = c;
+				else
+					b = c;
+			}
+			return ln.origin + ln.direction * b;
+		}
+		if (t >= ln.maximum)
+			return Vec3::Nan();
+	}
+	// the rest of the segment was not searched, the miss may be false
+	if (stepLimitHits++ == 0)
+		CAGE_LOG(SeverityEnum::Warning, "fieldIntersection", "sphere tracing has exhausted the step limit, reporting a miss");
+	return Vec3::Nan();
+}
+
+bool terrainFieldEnabled()
+{
+	return confFieldBackend;
+}
@@ -0,0 +1,168 @@
+#include "frameArena.h"
+
+#include <cage-simple/engine.h>
+
+#include <atomic>
+#include <cstdlib> // std::malloc, std::aligned_alloc
+#include <cstddef> // std::max_align_t
+#include <new>
+#include <memory>
+
+#ifdef CAGE_SYSTEM_WINDOWS
+#include <malloc.h> // _aligned_malloc
+#endif
+
+namespace
+{
+	constexpr uintPtr InitialCapacity = 1024 * 1024;
+
+	struct Chunk
+	{
+		std::unique_ptr<char[]> data;
+		uintPtr capacity = 0;
+	};
+
+	// the first chunk is the main one, additional chunks are used when it overflows
+	// they are merged into a bigger main chunk on reset, so that following ticks fit into one chunk
+	std::vector<Chunk> chunks;
+	uintPtr used = 0; // in the last chunk
+
+	void addChunk(uintPtr capacity)
+	{
+		Chunk c;
+		c.data = std::make_unique<char[]>(capacity);
+		c.capacity = capacity;
+		chunks.push_back(std::move(c));
+		used = 0;
+	}
+
+#ifdef CAGE_DEBUG
+	thread_local bool countAllocations = false;
+	std::atomic<uint32> allocationsCounter {0};
+#endif // CAGE_DEBUG
+	uint32 lastTickAllocations = 0;
+
+	void tickBegin()
+	{
+#ifdef CAGE_DEBUG
+		allocationsCounter = 0;
+		countAllocations = true;
+#endif // CAGE_DEBUG
+	}
+
+	void tickEnd()
+	{
+#ifdef CAGE_DEBUG
+		countAllocations = false;
+		lastTickAllocations = allocationsCounter;
+#endif // CAGE_DEBUG
+
+		if (chunks.size() > 1)
+		{
+			uintPtr total = 0;
+			for (const Chunk &c : chunks)
+				total += c.capacity;
+			chunks.clear();
+			addChunk(total);
+		}
+		used = 0;
+	}
+
+	class Callbacks
+	{
+		EventListener<void()> tickBeginListener;
+		EventListener<void()> tickEndListener;
+	public:
+		Callbacks()
+		{
+			// surround all other listeners, including the tick budget
+			tickBeginListener.attach(controlThread().update, -1000001);
+			tickBeginListener.bind<&tickBegin>();
+			tickEndListener.attach(controlThread().update, 1000001);
+			tickEndListener.bind<&tickEnd>();
+		}
+	} callbacksInstance;
+}
+
+void *frameAllocate(uintPtr size, uintPtr alignment)
+{
+	CAGE_ASSERT(alignment > 0 && (alignment & (alignment - 1)) == 0 && alignment <= alignof(std::max_align_t));
+	if (chunks.empty())
+		addChunk(InitialCapacity);
+	uintPtr offset = (used + alignment - 1) & ~(alignment - 1);
+	if (offset + size > chunks.back().capacity)
+	{
+		addChunk(max(InitialCapacity, size + alignment));
+		offset = 0;
+	}
+	void *res = chunks.back().data.get() + offset;
+	used = offset + size;
+	return res;
+}
+
+uint32 frameHeapAllocations()
+{
+	return lastTickAllocations;
+}
+
+uint32 frameHeapAllocationsSoFar()
+{
+#ifdef CAGE_DEBUG
+	return allocationsCounter;
+#else
+	return 0;
+#endif // CAGE_DEBUG
+}
+
+#ifdef CAGE_DEBUG
+
+void *operator new(std::size_t size)
+{
+	if (countAllocations)
+		allocationsCounter++;
+	if (void *p = std::malloc(size ? size : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	std::free(p);
+}
+
+// msvc has no aligned_alloc, and its aligned memory must be released with _aligned_free
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+	if (countAllocations)
+		allocationsCounter++;
+	const std::size_t a = (std::size_t)alignment;
+#ifdef CAGE_SYSTEM_WINDOWS
+	if (void *p = _aligned_malloc(size ? size : 1, a))
+		return p;
+#else
+	if (void *p = std::aligned_alloc(a, (max(size, std::size_t(1)) + a - 1) & ~(a - 1)))
+		return p;
+#endif // CAGE_SYSTEM_WINDOWS
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+#ifdef CAGE_SYSTEM_WINDOWS
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif // CAGE_SYSTEM_WINDOWS
+}
+
+void operator delete(void *p, std::size_t, std::align_val_t alignment) noexcept
+{
+	operator delete(p, alignment);
+}
+
+#endif // CAGE_DEBUG
@@ -0,0 +1,45 @@
+#ifndef flittermouse_frameArena_h_m5t9b3x7
+#define flittermouse_frameArena_h_m5t9b3x7
+
+#include "common.h"
+
+#include <vector>
+#include <set>
+#include <functional> // std::less
+
+// linear allocator for transient data of a single control tick
+// everything is released at once at the end of the tick, memory is reused by the following ticks
+// control thread only
+void *frameAllocate(uintPtr size, uintPtr alignment);
+
+// number of global heap allocations made by the control thread during the last tick
+// counted in debug builds only, including the aligned operator new
+// allocations made by the engine through its own allocators bypass the global operator new and are not counted
+uint32 frameHeapAllocations();
+uint32 frameHeapAllocationsSoFar(); // in the current tick, used to attribute the allocations to the tick budgets
+
+template<class T>
+struct FrameAllocator
+{
+	using value_type = T;
+
+	FrameAllocator() = default;
+	template<class U>
+	FrameAllocator(const FrameAllocator<U> &) noexcept {}
+
+	T *allocate(std::size_t n) { return (T *)frameAllocate(n * sizeof(T), alignof(T)); }
+	void deallocate(T *, std::size_t) noexcept {}
+
+	template<class U>
+	bool operator == (const FrameAllocator<U> &) const noexcept { return true; }
+	template<class U>
+	bool operator != (const FrameAllocator<U> &) const noexcept { return false; }
+};
+
+// must not outlive the tick
+template<class T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+template<class T, class Compare = std::less<T>>
+using FrameSet = std::set<T, Compare, FrameAllocator<T>>;
+
+#endif
@@ -1,15 +1,29 @@
 #include "common.h"
+#include "tickBudget.h"
+#include "frameArena.h"
 
 #include <cage-engine/guiBuilder.h>
 #include <cage-simple/engine.h>
 
 namespace
 {
+	TickBudget tickBudget("gui");
+
 	void engineUpdate()
 	{
+		TickBudgetScope budgetScope(tickBudget);
 		EntityManager *ents = engineGuiEntities();
 		ents->get(1)->value<GuiTextComponent>().value = Stringizer() + playerPosition;
 		ents->get(2)->value<GuiTextComponent>().value = Stringizer() + terrainGenerationProgress * 100 + " %";
+		ents->get(3)->value<GuiTextComponent>().value = Stringizer() + terrainRayCacheHitRate() * 100 + " %";
+		const TerrainStreamingStatistics st = terrainStreamingStatistics();
+		ents->get(4)->value<GuiTextComponent>().value = Stringizer() + st.queueGenerate + " / " + st.queueUpload + " / " + st.queueColliders + " (free " + st.freeSlots + ")";
+		ents->get(5)->value<GuiTextComponent>().value = Stringizer() + st.generatorsActive + " at " + st.generatorsUtilization * 100 + " %";
+		ents->get(6)->value<GuiTextComponent>().value = Stringizer() + st.latency[0] + " / " + st.latency[1] + " / " + st.latency[2] + " ms";
+		ents->get(7)->value<GuiTextComponent>().value = Stringizer() + frameHeapAllocations();
+		uint32 name = 10;
+		for (const TickBudget *b : tickBudgets())
+			ents->get(name++)->value<GuiTextComponent>().value = Stringizer() + b->average + " / " + b->maximum + " ms (" + b->overruns + "), " + b->allocations + " allocations";
 	}
 
 	void engineInitialize()
@@ -22,6 +36,22 @@ namespace
 		g->setNextName(1).label().text("");
 		g->label().text("Loading: ");
 		g->setNextName(2).label().text("");
+		g->label().text("Ray cache: ");
+		g->setNextName(3).label().text("");
+		g->label().text("Queues: ");
+		g->setNextName(4).label().text("");
+		g->label().text("Generators: ");
+		g->setNextName(5).label().text("");
+		g->label().text("Tile latency: ");
+		g->setNextName(6).label().text("");
+		g->label().text("Tick allocations: ");
+		g->setNextName(7).label().text("");
+		uint32 name = 10;
+		for (const TickBudget *b : tickBudgets())
+		{
+			g->label().text(Stringizer() + b->name + ": ");
+			g->setNextName(name++).label().text("");
+		}
 	}
 
 	class Callbacks
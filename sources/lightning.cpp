@@ -0,0 +1,261 @@
+#include "common.h"
+#include "profiler.h"
+#include "tickBudget.h"
+
+#include <cage-core/entities.h>
+#include <cage-core/hashString.h>
+#include <cage-core/config.h>
+#include <cage-engine/scene.h>
+#include <cage-simple/engine.h>
+
+#include <vector>
+#include <algorithm>
+
+namespace
+{
+	const ConfigSint32 confCapacity("flittermouse/lightning/capacity", 4096);
+	const ConfigSint32 confLifetime("flittermouse/lightning/lifetime", 1); // ticks
+	const ConfigSint32 confLights("flittermouse/lightning/lights", 6);
+
+	struct Stamped : public LightningSegment
+	{
+		uint64 tick = 0;
+	};
+
+	struct LightCluster
+	{
+		Vec3 position; // sum, weighted
+		Vec3 color; // sum, weighted
+		Real weight;
+	};
+
+	// segments live in a ring buffer, the oldest are overwritten when it is full
+	std::vector<Stamped> ring;
+	uint32 ringHead = 0;
+	uint32 ringCount = 0;
+	uint64 currentTick = 0;
+
+	// one light per discharge, kept as long as its segments
+	struct DischargeLight
+	{
+		Vec3 position;
+		Vec3 color;
+		uint64 tick = 0;
+	};
+
+	std::vector<DischargeLight> discharges;
+	std::vector<LightCluster> clusters; // rebuilt every tick from the live discharges
+	std::vector<LightningSegment> scratch;
+
+	// entities are reused between ticks instead of creating one for each segment
+	std::vector<Entity *> segmentEntities;
+	std::vector<Entity *> lightEntities;
+
+	void ensureCapacity()
+	{
+		const uint32 cap = max(sint32(confCapacity), 0);
+		if (ring.size() == cap)
+			return;
+		ring.clear();
+		ring.resize(cap);
+		scratch.resize(cap);
+		ringHead = ringCount = 0;
+	}
+
+	void push(const LightningSegment &s)
+	{
+		if (ring.empty())
+			return;
+		const uint32 cap = numeric_cast<uint32>(ring.size());
+		Stamped &r = ring[(ringHead + ringCount) % cap];
+		(LightningSegment &)r = s;
+		r.tick = currentTick;
+		if (ringCount < cap)
+			ringCount++;
+		else
+			ringHead = (ringHead + 1) % cap;
+	}
+
+	// too many lights are merged into the closest one
+	void addLight(const Vec3 &position, const Vec3 &color, Real weight)
+	{
+		const uint32 limit = max(sint32(confLights), 0);
+		if (limit == 0)
+			return;
+		if (clusters.size() < limit)
+		{
+			clusters.push_back({ position * weight, color * weight, weight });
+			return;
+		}
+		LightCluster *best = nullptr;
+		Real bestDist = Real::Infinity();
+		for (LightCluster &c : clusters)
+		{
+			const Real d = distanceSquared(c.position / c.weight, position);
+			if (d < bestDist)
+			{
+				bestDist = d;
+				best = &c;
+			}
+		}
+		best->position += position * weight;
+		best->color += color * weight;
+		best->weight += weight;
+	}
+
+	Entity *segmentEntity(uint32 index)
+	{
+		while (segmentEntities.size() <= index)
+		{
+			Entity *e = engineEntities()->createAnonymous();
+			e->value<TextureAnimationComponent>();
+			segmentEntities.push_back(e);
+		}
+		return segmentEntities[index];
+	}
+
+	Entity *lightEntity(uint32 index)
+	{
+		while (lightEntities.size() <= index)
+			lightEntities.push_back(engineEntities()->createAnonymous());
+		return lightEntities[index];
+	}
+
+	TickBudget tickBudget("lightning");
+
+	void engineUpdate()
+	{
+		TickBudgetScope budgetScope(tickBudget);
+		FLITTERMOUSE_PROFILE("lightning update");
+		ensureCapacity();
+		const uint32 cap = numeric_cast<uint32>(ring.size());
+
+		// expire old segments and their lights
+		const uint64 lifetime = max(sint32(confLifetime), 1);
+		while (ringCount && ring[ringHead].tick + lifetime <= currentTick)
+		{
+			ringHead = (ringHead + 1) % cap;
+			ringCount--;
+		}
+		discharges.erase(std::remove_if(discharges.begin(), discharges.end(), [&](const DischargeLight &d) { return d.tick + lifetime <= currentTick; }), discharges.end());
+		for (const DischargeLight &d : discharges)
+			addLight(d.position, d.color, 2);
+
+		// apply segments to the pooled entities
+		for (uint32 i = 0; i < ringCount; i++)
+		{
+			const Stamped &s = ring[(ringHead + i) % cap];
+			Entity *e = segmentEntity(i);
+			TransformComponent &t = e->value<TransformComponent>();
+			t.position = s.position;
+			t.orientation = s.orientation;
+			t.scale = s.length;
+			RenderComponent &r = e->value<RenderComponent>();
+			r.object = HashString("flittermouse/lightning/lightning.obj");
+			r.color = s.color;
+			e->value<TextureAnimationComponent>().offset = s.animationOffset;
+		}
+		for (uint32 i = ringCount; i < segmentEntities.size(); i++)
+			segmentEntities[i]->remove<RenderComponent>();
+
+		// apply the merged lights
+		for (uint32 i = 0; i < clusters.size(); i++)
+		{
+			const LightCluster &c = clusters[i];
+			Entity *e = lightEntity(i);
+			e->value<TransformComponent>().position = c.position / c.weight;
+			cage::LightComponent &light = e->value<cage::LightComponent>();
+			light.color = c.color / c.weight;
+			light.intensity = 1.5 * c.weight;
+			light.lightType = LightTypeEnum::Point;
+			light.attenuation = Vec3(0.5, 0, 0.4);
+		}
+		for (uint32 i = numeric_cast<uint32>(clusters.size()); i < lightEntities.size(); i++)
+			lightEntities[i]->remove<cage::LightComponent>();
+		clusters.clear();
+
+		currentTick++;
+	}
+
+	void engineFinalize()
+	{
+		ring.clear();
+		ringHead = ringCount = 0;
+		discharges.clear();
+		clusters.clear();
+		segmentEntities.clear();
+		lightEntities.clear();
+	}
+
+	class Callbacks
+	{
+		EventListener<void()> engineUpdateListener;
+		EventListener<void()> engineFinalizeListener;
+	public:
+		Callbacks()
+		{
+			// after all systems that emit discharges
+			engineUpdateListener.attach(controlThread().update, 200);
+			engineUpdateListener.bind<&engineUpdate>();
+			engineFinalizeListener.attach(controlThread().finalize);
+			engineFinalizeListener.bind<&engineFinalize>();
+		}
+	} callbacksInstance;
+}
+
+uint32 lightningGenerate(const Vec3 &a, const Vec3 &b, const Vec3 &cam, const Vec3 &color, RandomGenerator &rng, PointerRange<LightningSegment> output)
+{
+#ifdef CAGE_DEBUG
+	constexpr Real threshold = 0.15;
+#else
+	constexpr Real threshold = 0.03;
+#endif // CAGE_DEBUG
+
+	// depth-first subdivision with an explicit stack, segments are emitted from a to b
+	struct Pending
+	{
+		Vec3 a, b;
+	};
+	Pending stack[64];
+	uint32 stackSize = 0;
+	stack[stackSize++] = { a, b };
+	uint32 count = 0;
+	while (stackSize && count < output.size())
+	{
+		const Pending p = stack[--stackSize];
+		const Real d = distance(p.a, p.b);
+		const Vec3 v = normalize(p.b - p.a);
+		Vec3 c = (p.a + p.b) * 0.5;
+		const Vec3 up = normalize(cam - c);
+		if (d > threshold && stackSize + 2 <= sizeof(stack) / sizeof(stack[0]))
+		{
+			const Vec3 side = normalize(cross(v, up));
+			c += side * (d * rng.randomRange(-0.2, 0.2));
+			stack[stackSize++] = { c, p.b };
+			stack[stackSize++] = { p.a, c };
+			continue;
+		}
+		LightningSegment &s = output[count++];
+		s.position = c;
+		s.orientation = Quat(v, up, true);
+		s.length = d;
+		s.color = color;
+		s.animationOffset = rng.randomChance() * 100;
+	}
+	return count;
+}
+
+void lightningDischarge(const Vec3 &a, const Vec3 &b, const Vec3 &cam, const Vec3 &color)
+{
+	ensureCapacity();
+	const uint32 cnt = lightningGenerate(a, b, cam, color, detail::randomGenerator(), scratch);
+	lightningSubmit({ scratch.data(), scratch.data() + cnt }, (a + b) * 0.5, color);
+}
+
+void lightningSubmit(PointerRange<const LightningSegment> segments, const Vec3 &light, const Vec3 &color)
+{
+	ensureCapacity();
+	for (const LightningSegment &s : segments)
+		push(s);
+	discharges.push_back({ light, color, currentTick });
+}
@@ -1,4 +1,6 @@
 #include "common.h"
+#include "profiler.h"
+#include "tickBudget.h"
 
 #include <cage-core/geometry.h>
 #include <cage-core/entities.h>
@@ -7,24 +9,41 @@
 #include <cage-core/color.h>
 #include <cage-core/spatialStructure.h>
 #include <cage-core/variableSmoothingBuffer.h>
+#include <cage-core/concurrent.h>
 #include <cage-engine/scene.h>
 #include <cage-engine/sceneScreenSpaceEffects.h>
 #include <cage-engine/window.h>
 #include <cage-simple/engine.h>
 
 Vec3 playerPosition;
+Real playerViewScale = 1000;
 Real terrainGenerationProgress;
 
 namespace
 {
+	// glfw key codes, as reported by InputKey
+	constexpr uint32 KeyF9 = 298;
+	constexpr uint32 KeyF10 = 299;
+
 	bool keyboardKeys[6]; // wsadeq
 	Vec3 mouseMoved; 
 
 	VariableSmoothingBuffer<Quat, 3> cameraSmoothing;
 	Vec3 playerSpeed;
 
+	TickBudget tickBudget("player");
+
+	Mutex *viewMutex()
+	{
+		static Holder<Mutex> mut = newMutex();
+		return +mut;
+	}
+
+	PlayerView view;
+
 	void engineUpdate()
 	{
+		TickBudgetScope budgetScope(tickBudget);
 		uint64 time = engineControlTime();
 		TransformComponent &ct = engineEntities()->get(1)->value<TransformComponent>();
 		TransformComponent &pt = engineEntities()->get(10)->value<TransformComponent>();
@@ -54,7 +73,20 @@ namespace
 			ct.position = pt.position + ct.orientation * Vec3(0, 0.05, 0.2);
 		}
 
+		{ // update projection scale
+			const CameraComponent &cc = engineEntities()->get(1)->value<CameraComponent>();
+			const Vec2i res = engineWindow()->resolution();
+			if (res[1] > 0)
+				playerViewScale = res[1] / (2 * tan(cc.cameraFov * 0.5));
+		}
+
 		playerPosition = pt.position;
+
+		{ // publish for the generator threads
+			ScopeLock<Mutex> lock(viewMutex());
+			view.position = playerPosition;
+			view.viewScale = playerViewScale;
+		}
 	}
 
 	void setKeyboardKey(uint32 key, bool v)
@@ -89,6 +121,15 @@ namespace
 	void keyPress(InputKey in)
 	{
 		setKeyboardKey(in.key, true);
+		switch (in.key)
+		{
+		case KeyF9:
+			profilerEnabled(!profilerEnabled());
+			break;
+		case KeyF10:
+			profilerDumpBackground("flittermouse.trace.json");
+			break;
+		}
 	}
 
 	void keyRelease(InputKey in)
@@ -177,3 +218,9 @@ namespace
 		}
 	} callbacksInstance;
 }
+
+PlayerView playerViewSnapshot()
+{
+	ScopeLock<Mutex> lock(viewMutex());
+	return view;
+}
@@ -0,0 +1,158 @@
+#include "profiler.h"
+
+#include <cage-core/concurrent.h>
+#include <cage-core/files.h>
+#include <cage-core/string.h>
+
+#include <vector>
+#include <memory>
+
+std::atomic<bool> profilerEnabledFlag {false};
+
+namespace
+{
+	constexpr uint32 EventsCapacity = 1 << 16; // per thread, the oldest events are overwritten
+
+	struct Event
+	{
+		const char *name = nullptr;
+		uint64 start = 0;
+		uint64 duration = 0;
+	};
+
+	// written by a single thread only, the dump reads the published part
+	struct ThreadBuffer
+	{
+		std::vector<Event> events = std::vector<Event>(EventsCapacity);
+		std::atomic<uint64> written {0};
+		uint64 threadId = 0;
+		String threadName;
+	};
+
+	Holder<Mutex> &buffersMutex()
+	{
+		static Holder<Mutex> mut = newMutex();
+		return mut;
+	}
+
+	// buffers are never freed, so that a dump may run while threads exit
+	std::vector<std::unique_ptr<ThreadBuffer>> &buffers()
+	{
+		static std::vector<std::unique_ptr<ThreadBuffer>> b;
+		return b;
+	}
+
+	ThreadBuffer *threadBuffer()
+	{
+		thread_local ThreadBuffer *buf = nullptr;
+		if (!buf)
+		{
+			auto b = std::make_unique<ThreadBuffer>();
+			b->threadId = currentThreadId();
+			b->threadName = currentThreadName();
+			buf = b.get();
+			ScopeLock<Mutex> lock(buffersMutex());
+			buffers().push_back(std::move(b));
+		}
+		return buf;
+	}
+
+	String escape(const String &s)
+	{
+		return replace(replace(s, "\\", "\\\\"), "\"", "\\\"");
+	}
+
+	// copies the events that the owner thread has not overwritten during the copy
+	// the owner may be writing the slot after the last published event, so that one is excluded too
+	void copyEvents(const ThreadBuffer *b, std::vector<Event> &out)
+	{
+		const uint64 written = b->written.load(std::memory_order_acquire);
+		const uint64 begin = written > EventsCapacity ? written - EventsCapacity : 0;
+		out.resize(written - begin);
+		for (uint64 i = begin; i < written; i++)
+			out[i - begin] = b->events[i % EventsCapacity];
+		std::atomic_thread_fence(std::memory_order_acquire);
+		const uint64 after = b->written.load(std::memory_order_relaxed);
+		if (after + 1 > begin + EventsCapacity)
+		{
+			const uint64 skip = min(after + 1 - EventsCapacity - begin, written - begin);
+			out.erase(out.begin(), out.begin() + skip);
+		}
+	}
+
+	Holder<Thread> dumpThread;
+	String dumpPath;
+
+	void dumpEntry()
+	{
+		try
+		{
+			profilerDump(dumpPath);
+		}
+		catch (...)
+		{
+			detail::logCurrentCaughtException();
+		}
+	}
+}
+
+void profilerEnabled(bool enabled)
+{
+	profilerEnabledFlag = enabled;
+	CAGE_LOG(SeverityEnum::Info, "profiler", Stringizer() + "profiler " + (enabled ? "enabled" : "disabled"));
+}
+
+void profilerDump(const String &path)
+{
+	Holder<File> f = writeFile(path);
+	f->writeLine("{\"traceEvents\":[");
+	bool first = true;
+	const auto &line = [&](const String &s) {
+		f->writeLine(Stringizer() + (first ? "" : ",") + s);
+		first = false;
+	};
+	uint64 total = 0;
+	std::vector<Event> events;
+	{
+		ScopeLock<Mutex> lock(buffersMutex());
+		for (const auto &b : buffers())
+		{
+			line(Stringizer() + "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + b->threadId + ",\"args\":{\"name\":\"" + escape(b->threadName) + "\"}}");
+			copyEvents(b.get(), events);
+			for (const Event &e : events)
+				line(Stringizer() + "{\"name\":\"" + e.name + "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + b->threadId + ",\"ts\":" + e.start + ",\"dur\":" + e.duration + "}");
+			total += events.size();
+		}
+	}
+	f->writeLine("]}");
+	f->close();
+	CAGE_LOG(SeverityEnum::Info, "profiler", Stringizer() + "written " + total + " events to: " + path);
+}
+
+void profilerDumpBackground(const String &path)
+{
+	if (dumpThread && !dumpThread->done())
+	{
+		CAGE_LOG(SeverityEnum::Warning, "profiler", "previous dump is still running");
+		return;
+	}
+	dumpThread.clear();
+	dumpPath = path;
+	dumpThread = newThread(Delegate<void()>().bind<&dumpEntry>(), "profiler dump");
+}
+
+uint64 ProfileScope::profilerTime()
+{
+	return applicationTime() + 1; // zero is reserved for disabled scopes
+}
+
+void ProfileScope::record()
+{
+	ThreadBuffer *b = threadBuffer();
+	const uint64 w = b->written.load(std::memory_order_relaxed);
+	Event &e = b->events[w % EventsCapacity];
+	e.name = name;
+	e.start = start - 1;
+	e.duration = profilerTime() - start;
+	b->written.store(w + 1, std::memory_order_release);
+}
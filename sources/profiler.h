@@ -0,0 +1,48 @@
+#ifndef flittermouse_profiler_h_f8e2k1w9
+#define flittermouse_profiler_h_f8e2k1w9
+
+#include "common.h"
+
+#include <atomic>
+
+// scoped timers collected into per-thread buffers and exported as chrome trace json (chrome://tracing or perfetto)
+// when disabled, each scope costs one relaxed atomic load
+
+extern std::atomic<bool> profilerEnabledFlag;
+
+void profilerEnabled(bool enabled);
+inline bool profilerEnabled() { return profilerEnabledFlag.load(std::memory_order_relaxed); }
+void profilerDump(const String &path); // writes the events recorded so far, callable from any thread, recording continues meanwhile
+void profilerDumpBackground(const String &path); // same on a dedicated thread, ignored while a previous dump is still running
+
+// the name must be a string literal or otherwise outlive the profiler
+struct ProfileScope
+{
+	explicit ProfileScope(const char *name) : name(name)
+	{
+		if (profilerEnabled())
+			start = profilerTime();
+	}
+
+	~ProfileScope()
+	{
+		if (start)
+			record();
+	}
+
+	ProfileScope(const ProfileScope &) = delete;
+	ProfileScope &operator = (const ProfileScope &) = delete;
+
+private:
+	const char *name = nullptr;
+	uint64 start = 0;
+
+	static uint64 profilerTime();
+	void record();
+};
+
+#define FLITTERMOUSE_PROFILE_JOIN2(A, B) A##B
+#define FLITTERMOUSE_PROFILE_JOIN(A, B) FLITTERMOUSE_PROFILE_JOIN2(A, B)
+#define FLITTERMOUSE_PROFILE(NAME) ProfileScope FLITTERMOUSE_PROFILE_JOIN(profileScope, __LINE__)(NAME)
+
+#endif
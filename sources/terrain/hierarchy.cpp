@@ -20,13 +20,13 @@ namespace
 
 	bool coarsenessTest(const TilePos &pos)
 	{
-		Real d = pos.distanceToPlayer();
-		return d > pos.radius * 4;
+		Real d = pos.distanceTo(playerPosition);
+		return d > pos.radius * TerrainCoarsenessRadii;
 	}
 
-	void traverse(TilePos pos, std::set<TilePos> &tilesRequests, const std::set<TilePos> &tilesReady)
+	void traverse(TilePos pos, FrameSet<TilePos> &tilesRequests, const FrameSet<TilePos> &tilesReady)
 	{
-		if (pos.radius <= 4 || coarsenessTest(pos))
+		if (pos.radius <= TerrainFinestRadius || coarsenessTest(pos))
 		{
 			pos.visible = true;
 			tilesRequests.insert(pos);
@@ -55,11 +55,11 @@ namespace
 	}
 }
 
-std::set<TilePos> findNeededTiles(const std::set<TilePos> &tilesReady)
+FrameSet<TilePos> findNeededTiles(const FrameSet<TilePos> &tilesReady)
 {
-	std::set<TilePos> tilesRequests;
+	FrameSet<TilePos> tilesRequests;
 	TilePos pt;
-	constexpr sint32 TileSize = 32;
+	constexpr sint32 TileSize = TerrainCoarsestRadius * 2;
 	pt.pos[0] = numeric_cast<sint32>(playerPosition[0] / TileSize) * TileSize;
 	pt.pos[1] = numeric_cast<sint32>(playerPosition[1] / TileSize) * TileSize;
 	pt.pos[2] = numeric_cast<sint32>(playerPosition[2] / TileSize) * TileSize;
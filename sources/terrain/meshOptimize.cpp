@@ -0,0 +1,183 @@
+#include "terrain.h"
+
+#include <cage-core/mesh.h>
+
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+// vertex cache optimization based on: Tom Forsyth, Linear-Speed Vertex Cache Optimisation
+// https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+
+namespace
+{
+	constexpr uint32 ScoringCacheSize = 32;
+	constexpr uint32 SimulatedCacheSize = 16;
+
+	struct VertexData
+	{
+		std::vector<uint32> triangles; // triangles not yet emitted
+		float score = 0;
+		sint32 cachePosition = -1;
+	};
+
+	float vertexScore(const VertexData &v)
+	{
+		const uint32 remaining = numeric_cast<uint32>(v.triangles.size());
+		if (remaining == 0)
+			return -1;
+		float score = 0;
+		if (v.cachePosition >= 0)
+		{
+			if (v.cachePosition < 3)
+				score = 0.75f; // the last triangle was just emitted, do not favor it too much
+			else
+			{
+				const float f = 1 - float(v.cachePosition - 3) / (ScoringCacheSize - 3);
+				score = std::pow(f, 1.5f);
+			}
+		}
+		score += 2.0f / std::sqrt(float(remaining)); // favor vertices with few remaining triangles
+		return score;
+	}
+
+	Real averageCacheMissRatio(PointerRange<const uint32> indices)
+	{
+		if (indices.empty())
+			return 0;
+		std::vector<uint32> fifo;
+		fifo.reserve(SimulatedCacheSize);
+		uint32 misses = 0;
+		for (uint32 i : indices)
+		{
+			if (std::find(fifo.begin(), fifo.end(), i) != fifo.end())
+				continue;
+			misses++;
+			if (fifo.size() == SimulatedCacheSize)
+				fifo.erase(fifo.begin());
+			fifo.push_back(i);
+		}
+		return Real(misses) / (indices.size() / 3);
+	}
+
+	std::vector<uint32> reorderTriangles(PointerRange<const uint32> indices, uint32 verticesCount)
+	{
+		const uint32 trisCount = numeric_cast<uint32>(indices.size() / 3);
+		std::vector<VertexData> verts(verticesCount);
+		for (uint32 t = 0; t < trisCount; t++)
+			for (uint32 j = 0; j < 3; j++)
+				verts[indices[t * 3 + j]].triangles.push_back(t);
+		for (VertexData &v : verts)
+			v.score = vertexScore(v);
+		std::vector<bool> trisEmitted(trisCount);
+
+		std::vector<uint32> result;
+		result.reserve(indices.size());
+		std::vector<uint32> cache;
+		cache.reserve(ScoringCacheSize + 3);
+		uint32 bestTri = m;
+		uint32 scanStart = 0;
+		for (uint32 emitted = 0; emitted < trisCount; emitted++)
+		{
+			if (bestTri == m)
+			{ // no candidate in the cache, pick the next unprocessed triangle
+				while (trisEmitted[scanStart])
+					scanStart++;
+				bestTri = scanStart;
+			}
+
+			// emit the triangle
+			trisEmitted[bestTri] = true;
+			for (uint32 j = 0; j < 3; j++)
+			{
+				const uint32 vi = indices[bestTri * 3 + j];
+				result.push_back(vi);
+				std::vector<uint32> &vt = verts[vi].triangles;
+				vt.erase(std::find(vt.begin(), vt.end(), bestTri));
+				auto it = std::find(cache.begin(), cache.end(), vi);
+				if (it != cache.end())
+					cache.erase(it);
+				cache.insert(cache.begin(), vi);
+			}
+
+			// update scores of vertices in the cache, including those just evicted
+			for (uint32 i = 0; i < cache.size(); i++)
+			{
+				VertexData &v = verts[cache[i]];
+				v.cachePosition = i < ScoringCacheSize ? sint32(i) : -1;
+				v.score = vertexScore(v);
+			}
+			if (cache.size() > ScoringCacheSize)
+				cache.resize(ScoringCacheSize);
+
+			// find the best triangle among those touching the cache
+			bestTri = m;
+			float bestScore = -1;
+			for (uint32 vi : cache)
+			{
+				for (uint32 t : verts[vi].triangles)
+				{
+					const float s = verts[indices[t * 3 + 0]].score + verts[indices[t * 3 + 1]].score + verts[indices[t * 3 + 2]].score;
+					if (s > bestScore)
+					{
+						bestScore = s;
+						bestTri = t;
+					}
+				}
+			}
+		}
+		return result;
+	}
+
+	template<class T>
+	std::vector<T> remapAttribute(PointerRange<const T> src, const std::vector<uint32> &order)
+	{
+		std::vector<T> dst;
+		dst.reserve(order.size());
+		for (uint32 i : order)
+			dst.push_back(src[i]);
+		return dst;
+	}
+}
+
+MeshOptimizeStatistics meshOptimizeVertexCache(Mesh *mesh)
+{
+	CAGE_ASSERT(mesh->type() == MeshTypeEnum::Triangles);
+	MeshOptimizeStatistics stats;
+	stats.acmrBefore = averageCacheMissRatio(mesh->indices());
+
+	// triangles order
+	std::vector<uint32> indices = reorderTriangles(mesh->indices(), mesh->verticesCount());
+
+	// vertices order by first use
+	const uint32 verticesCount = mesh->verticesCount();
+	std::vector<uint32> remap(verticesCount, m);
+	std::vector<uint32> order;
+	order.reserve(verticesCount);
+	for (uint32 &i : indices)
+	{
+		if (remap[i] == m)
+		{
+			remap[i] = numeric_cast<uint32>(order.size());
+			order.push_back(i);
+		}
+		i = remap[i];
+	}
+	const Mesh *src = mesh;
+	if (!src->normals().empty())
+	{
+		const std::vector<Vec3> normals = remapAttribute(src->normals(), order);
+		mesh->normals(normals);
+	}
+	if (!src->uvs().empty())
+	{
+		const std::vector<Vec2> uvs = remapAttribute(src->uvs(), order);
+		mesh->uvs(uvs);
+	}
+	const std::vector<Vec3> positions = remapAttribute(src->positions(), order);
+	mesh->positions(positions);
+	mesh->indices(indices);
+
+	stats.acmrAfter = averageCacheMissRatio(mesh->indices());
+	return stats;
+}
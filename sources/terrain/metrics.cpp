@@ -0,0 +1,231 @@
+#include "terrain.h"
+#include "../tickBudget.h"
+
+#include <cage-core/config.h>
+#include <cage-core/files.h>
+#include <cage-simple/engine.h>
+
+#include <atomic>
+#include <cmath>
+#include <vector>
+
+namespace
+{
+	const ConfigString confFile("flittermouse/terrain/metrics/file", ""); // csv, empty to disable
+	const ConfigFloat confInterval("flittermouse/terrain/metrics/interval", 5); // seconds between rows in the file, each row covers the interval since the previous one
+	const ConfigUint32 confWindow("flittermouse/terrain/metrics/window", 10); // seconds covered by the latency shown in the hud
+
+	// logarithmic buckets, 4 per octave of microseconds, up to about 16 seconds
+	constexpr uint32 BucketsPerOctave = 4;
+	constexpr uint32 BucketsCount = 24 * BucketsPerOctave;
+	constexpr uint32 RadiusClasses = 8; // by log2 of the tile radius
+
+	constexpr const char *MetricNames[(uint32)TileMetricEnum::Count] = { "queueWait", "generateMesh", "generateUnwrap", "generateMaterial", "collider", "uploadWait", "total" };
+
+	// cumulative since startup, the windows are differences of two snapshots
+	std::atomic<uint32> histograms[(uint32)TileMetricEnum::Count][RadiusClasses][BucketsCount];
+
+	struct Snapshot
+	{
+		uint32 counts[(uint32)TileMetricEnum::Count][RadiusClasses][BucketsCount] = {};
+
+		void take()
+		{
+			for (uint32 i = 0; i < (uint32)TileMetricEnum::Count; i++)
+				for (uint32 r = 0; r < RadiusClasses; r++)
+					for (uint32 b = 0; b < BucketsCount; b++)
+						counts[i][r][b] = histograms[i][r][b];
+		}
+	};
+
+	Snapshot current;
+	std::vector<Snapshot> hudSnapshots; // one per second, ring buffer
+	uint32 hudNext = 0;
+	Snapshot fileBase; // as of the previous row
+
+	std::atomic<uint64> generatorsBusy {0};
+	uint32 generatorsCount = 0;
+	uint64 lastBusy = 0;
+	uint64 lastUtilizationTime = 0;
+	uint64 lastFileTime = 0;
+	Holder<File> file;
+
+	TerrainStreamingStatistics statistics;
+
+	uint32 bucketIndex(uint64 duration)
+	{
+		if (duration <= 1)
+			return 0;
+		const uint32 b = numeric_cast<uint32>(std::log2((double)duration) * BucketsPerOctave);
+		return min(b, BucketsCount - 1);
+	}
+
+	uint32 radiusClass(sint32 radius)
+	{
+		uint32 c = 0;
+		while (radius > 1 && c + 1 < RadiusClasses)
+		{
+			radius /= 2;
+			c++;
+		}
+		return c;
+	}
+
+	struct Percentiles
+	{
+		uint64 count = 0;
+		Real p[3]; // 50, 95, 99, milliseconds
+	};
+
+	// counts recorded between the base and the current snapshot
+	// radius class m combines all radii
+	Percentiles percentiles(const Snapshot &base, TileMetricEnum metric, uint32 radius)
+	{
+		uint64 counts[BucketsCount] = {};
+		Percentiles res;
+		for (uint32 r = 0; r < RadiusClasses; r++)
+		{
+			if (radius != m && radius != r)
+				continue;
+			for (uint32 b = 0; b < BucketsCount; b++)
+			{
+				const uint32 c = current.counts[(uint32)metric][r][b] - base.counts[(uint32)metric][r][b];
+				counts[b] += c;
+				res.count += c;
+			}
+		}
+		if (res.count == 0)
+			return res;
+		static constexpr double Quantiles[3] = { 0.5, 0.95, 0.99 };
+		for (uint32 q = 0; q < 3; q++)
+		{
+			const uint64 target = numeric_cast<uint64>(std::ceil(Quantiles[q] * res.count));
+			uint64 sum = 0;
+			uint32 b = 0;
+			while (b + 1 < BucketsCount && sum + counts[b] < target)
+				sum += counts[b++];
+			res.p[q] = std::exp2((double)(b + 1) / BucketsPerOctave) * 1e-3; // upper bound of the bucket
+		}
+		return res;
+	}
+
+	void writeRows(uint64 time)
+	{
+		const String path = confFile;
+		if (path.empty())
+		{
+			file.clear();
+			return;
+		}
+		if (!file)
+		{
+			file = cage::writeFile(path);
+			file->writeLine("time,metric,radius,count,p50,p95,p99");
+		}
+		for (uint32 metric = 0; metric < (uint32)TileMetricEnum::Count; metric++)
+		{
+			for (uint32 r = 0; r < RadiusClasses; r++)
+			{
+				const Percentiles p = percentiles(fileBase, (TileMetricEnum)metric, r);
+				if (p.count == 0)
+					continue;
+				file->writeLine(Stringizer() + time + "," + MetricNames[metric] + "," + (1u << r) + "," + p.count + "," + p.p[0] + "," + p.p[1] + "," + p.p[2]);
+			}
+		}
+		const TerrainStreamingStatistics &s = statistics;
+		file->writeLine(Stringizer() + time + ",queueGenerate,," + s.queueGenerate + ",,,");
+		file->writeLine(Stringizer() + time + ",queueUpload,," + s.queueUpload + ",,,");
+		file->writeLine(Stringizer() + time + ",queueColliders,," + s.queueColliders + ",,,");
+		file->writeLine(Stringizer() + time + ",freeSlots,," + s.freeSlots + ",,,");
+		file->writeLine(Stringizer() + time + ",generatorsUtilization,," + s.generatorsUtilization + ",,,");
+	}
+
+	TickBudget tickBudget("terrain metrics");
+
+	void engineUpdate()
+	{
+		TickBudgetScope budgetScope(tickBudget);
+		const uint64 time = applicationTime();
+
+		if (time > lastUtilizationTime + 1000000)
+		{
+			current.take();
+			const uint64 busy = generatorsBusy;
+			const uint64 wall = (time - lastUtilizationTime) * max(generatorsCount, 1u);
+			statistics.generatorsUtilization = Real(double(busy - lastBusy) / double(wall));
+			lastBusy = busy;
+			lastUtilizationTime = time;
+
+			// the oldest snapshot in the ring is the start of the window
+			const uint32 window = max(uint32(confWindow), 1u);
+			if (hudSnapshots.size() != window)
+			{
+				hudSnapshots.resize(window, current);
+				hudNext = 0;
+			}
+			const Percentiles total = percentiles(hudSnapshots[hudNext], TileMetricEnum::Total, m);
+			for (uint32 q = 0; q < 3; q++)
+				statistics.latency[q] = total.p[q];
+			hudSnapshots[hudNext] = current;
+			hudNext = (hudNext + 1) % window;
+		}
+
+		if (time > lastFileTime + numeric_cast<uint64>(Real(confInterval).value * 1e6))
+		{
+			current.take();
+			writeRows(time);
+			fileBase = current;
+			lastFileTime = time;
+		}
+	}
+
+	void engineFinalize()
+	{
+		file.clear();
+		hudSnapshots.clear();
+	}
+
+	class Callbacks
+	{
+		EventListener<void()> engineUpdateListener;
+		EventListener<void()> engineFinalizeListener;
+	public:
+		Callbacks()
+		{
+			engineUpdateListener.attach(controlThread().update);
+			engineUpdateListener.bind<&engineUpdate>();
+			engineFinalizeListener.attach(controlThread().finalize);
+			engineFinalizeListener.bind<&engineFinalize>();
+		}
+	} callbacksInstance;
+}
+
+void terrainMetricsRecord(TileMetricEnum metric, sint32 radius, uint64 duration)
+{
+	CAGE_ASSERT(metric < TileMetricEnum::Count);
+	histograms[(uint32)metric][radiusClass(radius)][bucketIndex(duration)]++;
+}
+
+void terrainMetricsQueues(uint32 generate, uint32 upload, uint32 colliders, uint32 freeSlots)
+{
+	statistics.queueGenerate = generate;
+	statistics.queueUpload = upload;
+	statistics.queueColliders = colliders;
+	statistics.freeSlots = freeSlots;
+}
+
+void terrainMetricsGenerators(uint32 count)
+{
+	generatorsCount = count;
+	statistics.generatorsActive = count;
+}
+
+void terrainMetricsGeneratorBusy(uint64 duration)
+{
+	generatorsBusy += duration;
+}
+
+TerrainStreamingStatistics terrainStreamingStatistics()
+{
+	return statistics;
+}
@@ -12,9 +12,9 @@ Transform TilePos::getTransform() const
 	return Transform(Vec3(pos[0], pos[1], pos[2]), Quat(), radius);
 }
 
-Real TilePos::distanceToPlayer() const
+Real TilePos::distanceTo(const Vec3 &point) const
 {
-	return distance(getBox(), playerPosition);
+	return cage::distance(getBox(), point);
 }
 
 bool TilePos::operator < (const TilePos &other) const
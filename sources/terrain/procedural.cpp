@@ -1,26 +1,51 @@
 #include "terrain.h"
+#include "../tileCollider.h"
+#include "../profiler.h"
 
-#include <cage-core/imageAlgorithms.h>
+#include <cage-core/image.h>
 #include <cage-core/meshAlgorithms.h>
-#include <cage-core/collider.h>
 #include <cage-core/marchingCubes.h>
 #include <cage-core/noiseFunction.h>
 #include <cage-core/random.h>
 #include <cage-core/color.h>
+#include <cage-core/config.h>
+#include <cage-core/tasks.h>
 
 #include <algorithm>
+#include <cmath>
 #include <vector>
 #include <array>
+#include <unordered_map>
+#include <cstring> // std::memcpy
 
 namespace
 {
-	const uint32 GlobalSeed = (uint32)detail::randomGenerator().next();
+	uint32 globalSeed = 0;
+	bool initialized = false;
+
+	// maximum size of a single texel and of a single marching cubes cell, as seen on the screen, in pixels
+	const ConfigFloat confTexelPixelError("flittermouse/terrain/texelPixelError", 4);
+	const ConfigFloat confGeometryPixelError("flittermouse/terrain/geometryPixelError", 12);
+	const ConfigBool confCompactVertices("flittermouse/terrain/compactVertices", true);
+	const ConfigBool confTriplanar("flittermouse/terrain/triplanar", false);
+
+	constexpr float TriplanarPeriod = 8; // world units covered by one repetition of the shared textures
+	constexpr uint32 TriplanarResolution = 256;
+
+	// tiles at least this large, or this far from the player, use per-vertex colors instead of textures
+	// the tiles have radius 16, 8, or 4, the default leaves textures only for the finest level
+	const ConfigSint32 confVertexColorRadius("flittermouse/terrain/vertexColorRadius", 8);
+	const ConfigFloat confVertexColorDistance("flittermouse/terrain/vertexColorDistance", 150);
+
+	// palette entry: 5 bits per albedo channel, 3 bits roughness, 2 bits metallic
+	constexpr uint32 PaletteResolution = 1024;
 
 	uint32 newSeed()
 	{
+		CAGE_ASSERT(initialized);
 		static uint32 index = 35741890;
 		index = hash(index);
-		return GlobalSeed + index;
+		return globalSeed + index;
 	}
 
 	Holder<NoiseFunction> newClouds(uint32 octaves)
@@ -298,11 +323,16 @@ namespace
 	struct ProcTile
 	{
 		TilePos pos;
+		PlayerView view;
 		Holder<Mesh> mesh;
-		Holder<Collider> collider;
+		std::vector<TerrainPart> parts;
+		Holder<TileCollider> collider;
 		Holder<Image> albedo;
 		Holder<Image> special;
+		std::vector<uint8> coverage; // per texel, nonzero when the texel belongs to a chart or the gutter
 		uint32 textureResolution = 0;
+		Real texelsPerUnit;
+		uint32 meshResolution = 0;
 	};
 
 	Real meshGeneratorImpl(const Vec3 &pt)
@@ -405,6 +435,7 @@ namespace
 		textureGeneratorImpl(position, color, roughness, metallic);
 		t->albedo->set(xy, color);
 		t->special->set(xy, Vec2(roughness, metallic));
+		t->coverage[xy[1] * t->textureResolution + xy[0]] = 1;
 	}
 
 	float averageEdgeLength(const Mesh *poly)
@@ -425,11 +456,40 @@ namespace
 		return (len / inds).value;
 	}
 
+	// screen pixels covered by one unit of the tile local space
+	Real screenDensity(const TilePos &pos, const PlayerView &view)
+	{
+		const Real d = max(pos.distanceTo(view.position), 1e-3);
+		return view.viewScale * pos.radius / d;
+	}
+
+	// the same for all tiles of the same radius, so that neighbours sample their shared borders identically
+	// uses the density at the distance where the tiles are split, which is the highest a tile of that radius is shown at
+	// the finest tiles are shown at any distance and use the maximum
+	// the view scale is rounded to a power of two, so that small window changes keep the resolution
+	uint32 meshResolutionForRadius(sint32 radius, const PlayerView &view)
+	{
+		if (radius <= TerrainFinestRadius)
+			return TerrainMeshResolutionMax;
+		const Real scale = std::exp2(std::round(std::log2(max(view.viewScale, 1).value)));
+		const Real density = scale / TerrainCoarsenessRadii;
+		return numeric_cast<uint32>(clamp(density * 2 / Real(confGeometryPixelError), Real(TerrainMeshResolutionMin), Real(TerrainMeshResolutionMax)));
+	}
+
+	void generateDetail(ProcTile &t)
+	{
+		FLITTERMOUSE_PROFILE("generateDetail");
+		const Real density = screenDensity(t.pos, t.view);
+		t.texelsPerUnit = clamp(density / Real(confTexelPixelError), 4, 50);
+		t.meshResolution = meshResolutionForRadius(t.pos.radius, t.view);
+	}
+
 	void generateMesh(ProcTile &t)
 	{
+		FLITTERMOUSE_PROFILE("generateMesh");
 		{
 			MarchingCubesCreateConfig cfg;
-			cfg.resolution = Vec3i(24);
+			cfg.resolution = Vec3i(t.meshResolution);
 			cfg.box = Aabb(Vec3(-1), Vec3(1));
 			cfg.clip = false;
 			Holder<MarchingCubes> cubes = newMarchingCubes(cfg);
@@ -440,26 +500,105 @@ namespace
 		{
 			meshClip(+t.mesh, Aabb(Vec3(-1.002), Vec3(1.002)));
 		}
+	}
 
-		{
-			MeshUnwrapConfig cfg;
-			cfg.texelsPerUnit = 50.0f;
-			t.textureResolution = meshUnwrap(+t.mesh, cfg);
-			CAGE_ASSERT(t.textureResolution <= 2048);
-			if (t.textureResolution == 0)
-				t.mesh->clear();
-		}
+	void generateUnwrap(ProcTile &t)
+	{
+		FLITTERMOUSE_PROFILE("generateUnwrap");
+		MeshUnwrapConfig cfg;
+		cfg.texelsPerUnit = t.texelsPerUnit;
+		t.textureResolution = meshUnwrap(+t.mesh, cfg);
+		CAGE_ASSERT(t.textureResolution <= 2048);
+		if (t.textureResolution == 0)
+			t.mesh->clear();
+	}
+
+	void optimizeMesh(ProcTile &t, Mesh *mesh)
+	{
+		FLITTERMOUSE_PROFILE("optimizeMesh");
+		const MeshOptimizeStatistics stats = meshOptimizeVertexCache(mesh);
+		CAGE_LOG_DEBUG(SeverityEnum::Info, "flittermouse", Stringizer() + "tile " + t.pos + ", vertex cache ACMR: " + stats.acmrBefore + " -> " + stats.acmrAfter);
 	}
 
 	void generateCollider(ProcTile &t)
 	{
-		t.collider = newCollider();
-		t.collider->importMesh(t.mesh.get());
-		t.collider->rebuild();
+		FLITTERMOUSE_PROFILE("generateCollider");
+		t.collider = newTileCollider(+t.mesh);
+	}
+
+	// fills the gutter around the charts with averages of the neighboring texels
+	// the seeds are found by one pass over the coverage, the rounds then visit only texels along the chart borders
+	// both images are processed together
+	void dilateTextures(ProcTile &t, uint32 rounds)
+	{
+		FLITTERMOUSE_PROFILE("dilateTextures");
+		const sint32 res = t.textureResolution;
+		std::vector<uint8> &cov = t.coverage;
+		std::vector<uint32> frontier, next;
+		const auto &border = [&](sint32 x, sint32 y) -> bool {
+			for (sint32 ny = max(y - 1, 0); ny <= min(y + 1, res - 1); ny++)
+				for (sint32 nx = max(x - 1, 0); nx <= min(x + 1, res - 1); nx++)
+					if (!cov[ny * res + nx])
+						return true;
+			return false;
+		};
+		for (sint32 y = 0; y < res; y++)
+			for (sint32 x = 0; x < res; x++)
+				if (cov[y * res + x] && border(x, y))
+					frontier.push_back(y * res + x); // seeds, covered texels with uncovered neighbors
+
+		for (uint32 round = 0; round < rounds; round++)
+		{
+			// candidates are uncovered neighbors of the previous round, marked with 2 to avoid duplicates
+			next.clear();
+			for (uint32 i : frontier)
+			{
+				const sint32 x = i % res, y = i / res;
+				for (sint32 ny = max(y - 1, 0); ny <= min(y + 1, res - 1); ny++)
+				{
+					for (sint32 nx = max(x - 1, 0); nx <= min(x + 1, res - 1); nx++)
+					{
+						const uint32 n = ny * res + nx;
+						if (cov[n])
+							continue;
+						cov[n] = 2;
+						next.push_back(n);
+					}
+				}
+			}
+
+			for (uint32 i : next)
+			{
+				const sint32 x = i % res, y = i / res;
+				Vec3 albedo;
+				Vec2 special;
+				uint32 cnt = 0;
+				for (sint32 ny = max(y - 1, 0); ny <= min(y + 1, res - 1); ny++)
+				{
+					for (sint32 nx = max(x - 1, 0); nx <= min(x + 1, res - 1); nx++)
+					{
+						if (cov[ny * res + nx] != 1)
+							continue;
+						albedo += t.albedo->get3(nx, ny);
+						special += t.special->get2(nx, ny);
+						cnt++;
+					}
+				}
+				CAGE_ASSERT(cnt > 0);
+				t.albedo->set(x, y, albedo / cnt);
+				t.special->set(x, y, special / cnt);
+			}
+
+			// the new texels become sources only for the next round
+			for (uint32 i : next)
+				cov[i] = 1;
+			std::swap(frontier, next);
+		}
 	}
 
 	void generateTextures(ProcTile &t)
 	{
+		FLITTERMOUSE_PROFILE("generateTextures");
 		CAGE_ASSERT(t.textureResolution > 0);
 		t.albedo = newImage();
 		t.albedo->initialize(t.textureResolution, t.textureResolution, 3);
@@ -469,44 +608,366 @@ namespace
 		MeshGenerateTextureConfig cfg;
 		cfg.generator.bind<ProcTile *, &textureGenerator>(&t);
 		cfg.width = cfg.height = t.textureResolution;
+		t.coverage.resize(t.textureResolution * t.textureResolution);
 		{
 			meshGenerateTexture(+t.mesh, cfg);
 		}
 		{
-			imageDilation(+t.albedo, 2);
-			imageDilation(+t.special, 2);
+			dilateTextures(t, 2);
+		}
+	}
+
+	uint16 packHalf(Real value)
+	{
+		const float f = value.value;
+		uint32 b = 0;
+		std::memcpy(&b, &f, sizeof(b));
+		const uint32 sign = (b >> 16) & 0x8000;
+		const sint32 exponent = sint32((b >> 23) & 0xff) - 127 + 15;
+		uint32 mantissa = b & 0x7fffff;
+		if (exponent <= 0)
+		{ // subnormal or zero
+			if (exponent < -10)
+				return numeric_cast<uint16>(sign);
+			mantissa |= 0x800000;
+			const uint32 shift = 14 - exponent;
+			uint32 h = mantissa >> shift;
+			if ((mantissa >> (shift - 1)) & 1)
+				h++;
+			return numeric_cast<uint16>(sign | h);
 		}
+		if (exponent >= 31)
+			return numeric_cast<uint16>(sign | 0x7c00); // infinity
+		uint32 h = sign | (uint32(exponent) << 10) | (mantissa >> 13);
+		if (mantissa & 0x1000)
+			h++; // rounding may carry into the exponent, which is still correct
+		return numeric_cast<uint16>(h);
 	}
 
-	class Initializer
+	Holder<TerrainMesh> generateCompactMesh(const Mesh *poly)
 	{
-	public:
-		Initializer()
+		CAGE_ASSERT(poly->type() == MeshTypeEnum::Triangles);
+		Holder<TerrainMesh> res = systemMemory().createHolder<TerrainMesh>();
+		const uint32 cnt = poly->verticesCount();
+		res->vertices.resize(cnt);
+		for (uint32 i = 0; i < cnt; i++)
 		{
-			// ensure consistent order of initialization of all the static noise functions
-			Vec3 p, c;
-			Real r, m;
-			for (uint32 i = 0; i < 5; i++)
-				basesSwitch(i, p, c, r, m);
-			textureGeneratorImpl(p, c, r, m);
-			meshGeneratorImpl(p);
+			TerrainVertex &v = res->vertices[i];
+			const Vec3 p = poly->positions()[i];
+			CAGE_ASSERT(abs(p[0]) <= 1 + 1e-5 && abs(p[1]) <= 1 + 1e-5 && abs(p[2]) <= 1 + 1e-5);
+			const Vec3 n = poly->normals()[i];
+			for (uint32 j = 0; j < 3; j++)
+			{
+				v.position[j] = packHalf(p[j]);
+				v.normal[j] = packHalf(n[j]);
+			}
+			const Vec2 uv = poly->uvs()[i];
+			v.uv[0] = packHalf(uv[0]);
+			v.uv[1] = packHalf(uv[1]);
+		}
+		res->indices = std::vector<uint32>(poly->indices().begin(), poly->indices().end());
+		return res;
+	}
+
+	void addPart(ProcTile &t, Holder<Mesh> mesh, TerrainMaterialEnum material)
+	{
+		TerrainPart p;
+		p.material = material;
+		if (confCompactVertices)
+			p.compactMesh = generateCompactMesh(+mesh);
+		else
+			p.mesh = std::move(mesh);
+		t.parts.push_back(std::move(p));
+	}
+
+	// splits the mesh by the dominant axis of triangle normals and projects world-aligned uvs
+	void generateTriplanarParts(ProcTile &t)
+	{
+		FLITTERMOUSE_PROFILE("generateTriplanarParts");
+		const Mesh *src = +t.mesh;
+		const Transform tr = t.pos.getTransform();
+		const Vec3 offset = t.pos.getBox().a; // keeps the uvs small for the half float vertices
+		std::array<std::vector<uint32>, 3> triangles;
+		const auto inds = src->indices();
+		for (uint32 i = 0; i < inds.size(); i += 3)
+		{
+			const Vec3 a = src->positions()[inds[i + 0]];
+			const Vec3 b = src->positions()[inds[i + 1]];
+			const Vec3 c = src->positions()[inds[i + 2]];
+			const Vec3 n = abs(cross(b - a, c - a));
+			const uint32 axis = n[0] > n[1] ? (n[0] > n[2] ? 0 : 2) : (n[1] > n[2] ? 1 : 2);
+			triangles[axis].insert(triangles[axis].end(), inds.begin() + i, inds.begin() + i + 3);
+		}
+
+		for (uint32 axis = 0; axis < 3; axis++)
+		{
+			if (triangles[axis].empty())
+				continue;
+			const uint32 u = (axis + 1) % 3;
+			const uint32 v = (axis + 2) % 3;
+			const Vec2 uvOffset = Vec2(floor(offset[u] / TriplanarPeriod), floor(offset[v] / TriplanarPeriod));
+			std::vector<uint32> remap(src->verticesCount(), m);
+			std::vector<Vec3> positions, normals;
+			std::vector<Vec2> uvs;
+			std::vector<uint32> indices;
+			indices.reserve(triangles[axis].size());
+			for (uint32 i : triangles[axis])
+			{
+				if (remap[i] == m)
+				{
+					remap[i] = numeric_cast<uint32>(positions.size());
+					const Vec3 p = src->positions()[i];
+					const Vec3 w = tr * p;
+					positions.push_back(p);
+					normals.push_back(src->normals()[i]);
+					uvs.push_back(Vec2(w[u], w[v]) / TriplanarPeriod - uvOffset);
+				}
+				indices.push_back(remap[i]);
+			}
+			Holder<Mesh> mesh = newMesh();
+			mesh->positions(positions);
+			mesh->normals(normals);
+			mesh->uvs(uvs);
+			mesh->indices(indices);
+			optimizeMesh(t, +mesh);
+			addPart(t, std::move(mesh), TerrainMaterialEnum((uint32)TerrainMaterialEnum::TriplanarX + axis));
+		}
+	}
+
+	void triplanarMaterial(uint32 axis, const Vec2 &uv, Vec3 &color, Real &roughness, Real &metallic)
+	{
+		Vec3 pos;
+		pos[(axis + 1) % 3] = uv[0] * TriplanarPeriod;
+		pos[(axis + 2) % 3] = uv[1] * TriplanarPeriod;
+		textureGeneratorImpl(pos * 10, color, roughness, metallic);
+	}
+
+	struct TriplanarBaker
+	{
+		uint32 axis = 0;
+		Image *albedo = nullptr;
+		Image *special = nullptr;
+	};
+
+	void triplanarBakeRow(TriplanarBaker *b, uint32 y)
+	{
+		for (uint32 x = 0; x < TriplanarResolution; x++)
+		{
+			// blend four shifted samples to make the texture seamlessly repeatable
+			const Vec2 uv = (Vec2(x, y) + 0.5) / TriplanarResolution;
+			Vec3 color;
+			Real roughness, metallic;
+			for (uint32 i = 0; i < 4; i++)
+			{
+				const Vec2 shift = Vec2(i % 2, i / 2);
+				const Real w = ((i % 2) ? uv[0] : 1 - uv[0]) * ((i / 2) ? uv[1] : 1 - uv[1]);
+				Vec3 c;
+				Real r, m;
+				triplanarMaterial(b->axis, uv - shift, c, r, m);
+				color += c * w;
+				roughness += r * w;
+				metallic += m * w;
+			}
+			b->albedo->set(x, y, color);
+			b->special->set(x, y, Vec2(roughness, metallic));
+		}
+	}
+
+	uint32 quantize(Real v, uint32 bits)
+	{
+		const uint32 mx = (1u << bits) - 1;
+		return numeric_cast<uint32>(round(saturate(v) * mx));
+	}
+
+	Real dequantize(uint32 v, uint32 bits)
+	{
+		const uint32 mx = (1u << bits) - 1;
+		return Real(v & mx) / mx;
+	}
+
+	uint32 paletteIndex(const Vec3 &color, Real roughness, Real metallic)
+	{
+		return quantize(color[0], 5) | (quantize(color[1], 5) << 5) | (quantize(color[2], 5) << 10) | (quantize(roughness, 3) << 15) | (quantize(metallic, 2) << 18);
+	}
+
+	Vec2 paletteUv(uint32 index)
+	{
+		return (Vec2(index % PaletteResolution, index / PaletteResolution) + 0.5) / PaletteResolution;
+	}
+
+	bool useVertexColors(const TilePos &pos, const PlayerView &view)
+	{
+		return pos.radius >= confVertexColorRadius || pos.distanceTo(view.position) >= Real(confVertexColorDistance);
+	}
+
+	// evaluates the material once per vertex and stores its palette entry in the vertex uv
+	// the uv must not vary across a face, so each face takes the entry shared by most of its vertices
+	// and only the remaining vertices are duplicated, along the boundaries between the entries
+	void generateVertexColors(ProcTile &t)
+	{
+		FLITTERMOUSE_PROFILE("generateVertexColors");
+		const Mesh *src = +t.mesh;
+		const Transform tr = t.pos.getTransform();
+		const uint32 verticesCount = src->verticesCount();
+		std::vector<uint32> entries; // palette entry per vertex
+		entries.reserve(verticesCount);
+		for (const Vec3 &p : src->positions())
+		{
+			Vec3 color;
+			Real roughness, metallic;
+			textureGeneratorImpl(tr * p * 10, color, roughness, metallic);
+			entries.push_back(paletteIndex(color, roughness, metallic));
+		}
+
+		std::unordered_map<uint64, uint32> remap;
+		remap.reserve(verticesCount + verticesCount / 4);
+		std::vector<Vec3> positions, normals;
+		std::vector<Vec2> uvs;
+		std::vector<uint32> indices;
+		positions.reserve(verticesCount);
+		normals.reserve(verticesCount);
+		uvs.reserve(verticesCount);
+		const auto inds = src->indices();
+		indices.reserve(inds.size());
+		for (uint32 i = 0; i < inds.size(); i += 3)
+		{
+			const uint32 a = entries[inds[i + 0]], b = entries[inds[i + 1]], c = entries[inds[i + 2]];
+			const uint32 pal = (b == c && a != b) ? b : a;
+			for (uint32 j = 0; j < 3; j++)
+			{
+				const uint32 v = inds[i + j];
+				auto it = remap.find((uint64(pal) << 32) | v);
+				if (it == remap.end())
+				{
+					it = remap.emplace((uint64(pal) << 32) | v, numeric_cast<uint32>(positions.size())).first;
+					positions.push_back(src->positions()[v]);
+					normals.push_back(src->normals()[v]);
+					uvs.push_back(paletteUv(pal));
+				}
+				indices.push_back(it->second);
+			}
+		}
+
+		Holder<Mesh> mesh = newMesh();
+		mesh->positions(positions);
+		mesh->normals(normals);
+		mesh->uvs(uvs);
+		mesh->indices(indices);
+		optimizeMesh(t, +mesh);
+		addPart(t, std::move(mesh), TerrainMaterialEnum::Palette);
+	}
+
+	void paletteBakeRow(Image *images[2], uint32 y)
+	{
+		for (uint32 x = 0; x < PaletteResolution; x++)
+		{
+			const uint32 index = y * PaletteResolution + x;
+			images[0]->set(x, y, Vec3(dequantize(index, 5), dequantize(index >> 5, 5), dequantize(index >> 10, 5)));
+			images[1]->set(x, y, Vec2(dequantize(index >> 15, 3), dequantize(index >> 18, 2)));
 		}
-	} initializer;
+	}
+}
+
+void terrainInitialize(uint32 seed)
+{
+	CAGE_ASSERT(!initialized);
+	globalSeed = seed;
+	initialized = true;
+
+	// ensure consistent order of initialization of all the static noise functions
+	Vec3 p, c;
+	Real r, m;
+	for (uint32 i = 0; i < 5; i++)
+		basesSwitch(i, p, c, r, m);
+	textureGeneratorImpl(p, c, r, m);
+	meshGeneratorImpl(p);
+}
+
+uint32 terrainSeed()
+{
+	CAGE_ASSERT(initialized);
+	return globalSeed;
 }
 
-void terrainGenerate(const TilePos &tilePos, Holder<Mesh> &mesh, Holder<Collider> &collider, Holder<Image> &albedo, Holder<Image> &special)
+void terrainGenerate(const TilePos &tilePos, const PlayerView &view, std::vector<TerrainPart> &parts, uint32 &meshResolution, Holder<Image> &albedo, Holder<Image> &special)
 {
 	ProcTile t;
 	t.pos = tilePos;
+	t.view = view;
+
+	uint64 time = applicationTime();
+	const auto &stage = [&](TileMetricEnum metric) {
+		const uint64 now = applicationTime();
+		terrainMetricsRecord(metric, tilePos.radius, now - time);
+		time = now;
+	};
 
+	generateDetail(t);
+	meshResolution = t.meshResolution;
 	generateMesh(t);
+	stage(TileMetricEnum::GenerateMesh);
 	if (t.mesh->facesCount() == 0)
 		return;
-	generateCollider(t);
-	generateTextures(t);
+	if (useVertexColors(t.pos, t.view))
+		generateVertexColors(t);
+	else if (confTriplanar)
+		generateTriplanarParts(t);
+	else
+	{
+		generateUnwrap(t);
+		stage(TileMetricEnum::GenerateUnwrap);
+		if (t.mesh->facesCount() == 0)
+			return;
+		optimizeMesh(t, +t.mesh);
+		generateTextures(t);
+		addPart(t, std::move(t.mesh), TerrainMaterialEnum::Unique);
+	}
+	stage(TileMetricEnum::GenerateMaterial);
 
-	mesh = std::move(t.mesh);
-	collider = std::move(t.collider);
+	parts = std::move(t.parts);
 	albedo = std::move(t.albedo);
 	special = std::move(t.special);
 }
+
+Holder<TileCollider> terrainGenerateCollider(const TilePos &tilePos, uint32 meshResolution)
+{
+	ProcTile t;
+	t.pos = tilePos;
+	t.meshResolution = meshResolution;
+	generateMesh(t);
+	generateCollider(t);
+	return std::move(t.collider);
+}
+
+Real terrainDensity(const Vec3 &position)
+{
+	return meshGeneratorImpl(position);
+}
+
+void terrainGenerateSharedMaterial(TerrainMaterialEnum material, Holder<Image> &albedo, Holder<Image> &special)
+{
+	FLITTERMOUSE_PROFILE("terrainGenerateSharedMaterial");
+	CAGE_ASSERT(material != TerrainMaterialEnum::Unique);
+	if (material == TerrainMaterialEnum::Palette)
+	{
+		albedo = newImage();
+		albedo->initialize(PaletteResolution, PaletteResolution, 3);
+		special = newImage();
+		special->initialize(PaletteResolution, PaletteResolution, 2);
+		special->colorConfig.gammaSpace = GammaSpaceEnum::Linear;
+		Image *images[2] = { +albedo, +special };
+		tasksRunBlocking("palette material", Delegate<void(uint32)>().bind<Image **, &paletteBakeRow>(images), PaletteResolution);
+		return;
+	}
+
+	albedo = newImage();
+	albedo->initialize(TriplanarResolution, TriplanarResolution, 3);
+	special = newImage();
+	special->initialize(TriplanarResolution, TriplanarResolution, 2);
+	special->colorConfig.gammaSpace = GammaSpaceEnum::Linear;
+	TriplanarBaker b;
+	b.axis = (uint32)material - (uint32)TerrainMaterialEnum::TriplanarX;
+	b.albedo = +albedo;
+	b.special = +special;
+	tasksRunBlocking("triplanar material", Delegate<void(uint32)>().bind<TriplanarBaker *, &triplanarBakeRow>(&b), TriplanarResolution);
+}
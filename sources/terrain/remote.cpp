@@ -0,0 +1,369 @@
+#include "terrain.h"
+#include "../tileCollider.h"
+
+#include <cage-core/networkTcp.h>
+#include <cage-core/memoryBuffer.h>
+#include <cage-core/serialization.h>
+#include <cage-core/image.h>
+#include <cage-core/mesh.h>
+#include <cage-core/config.h>
+#include <cage-core/concurrent.h>
+
+#include <array>
+#include <cstring> // std::memcpy
+
+namespace
+{
+	const ConfigSint32 confWorkersCount("flittermouse/terrain/workers/count", 0); // generator threads with lower index use a worker each, zero disables the workers
+	const ConfigString confWorkersAddress("flittermouse/terrain/workers/address", "127.0.0.1");
+	const ConfigSint32 confWorkersPort("flittermouse/terrain/workers/port", 27630); // port of the first worker, the following workers use consecutive ports
+	const ConfigSint32 confWorkersTimeout("flittermouse/terrain/workers/timeout", 10000); // milliseconds to wait for a result, then the tile is generated in process
+
+	constexpr uint32 ProtocolMagic = 0x746d6c66; // flmt
+	constexpr uint32 ProtocolVersion = 2;
+	constexpr uint32 MaxFrameSize = 256 * 1024 * 1024;
+	constexpr uint64 ReconnectDelay = 5000000;
+
+	/////////////////////////////////////////////////////////////////////////////
+	// SERIALIZATION
+	/////////////////////////////////////////////////////////////////////////////
+
+	template<class T>
+	void writeVector(Serializer &ser, const std::vector<T> &v)
+	{
+		ser << numeric_cast<uint32>(v.size());
+		ser.write({ (const char *)v.data(), (const char *)(v.data() + v.size()) });
+	}
+
+	template<class T>
+	void readVector(Deserializer &des, std::vector<T> &v)
+	{
+		uint32 cnt = 0;
+		des >> cnt;
+		v.resize(cnt);
+		const PointerRange<const char> data = des.read(cnt * sizeof(T));
+		if (cnt)
+			std::memcpy(v.data(), data.data(), data.size());
+	}
+
+	void writeBuffer(Serializer &ser, PointerRange<const char> buffer)
+	{
+		ser << numeric_cast<uint32>(buffer.size());
+		ser.write(buffer);
+	}
+
+	PointerRange<const char> readBuffer(Deserializer &des)
+	{
+		uint32 size = 0;
+		des >> size;
+		return des.read(size);
+	}
+
+	void writeImage(Serializer &ser, const Holder<Image> &img)
+	{
+		ser << bool(img);
+		if (!img)
+			return;
+		CAGE_ASSERT(img->format() == ImageFormatEnum::U8);
+		ser << img->resolution() << img->channels() << img->colorConfig;
+		writeBuffer(ser, img->rawViewU8());
+	}
+
+	Holder<Image> readImage(Deserializer &des)
+	{
+		bool present = false;
+		des >> present;
+		if (!present)
+			return {};
+		Vec2i resolution;
+		uint32 channels = 0;
+		ImageColorConfig colorConfig;
+		des >> resolution >> channels >> colorConfig;
+		Holder<Image> img = newImage();
+		img->importRaw(readBuffer(des), resolution, channels, ImageFormatEnum::U8);
+		img->colorConfig = colorConfig;
+		return img;
+	}
+
+	void writeCollider(Serializer &ser, const Holder<TileCollider> &collider)
+	{
+		ser << bool(collider);
+		if (!collider)
+			return;
+		writeVector(ser, collider->nodes);
+		writeVector(ser, collider->vertices);
+		writeVector(ser, collider->indices);
+		ser << collider->origin << collider->step;
+	}
+
+	Holder<TileCollider> readCollider(Deserializer &des)
+	{
+		bool present = false;
+		des >> present;
+		if (!present)
+			return {};
+		Holder<TileCollider> collider = systemMemory().createHolder<TileCollider>();
+		readVector(des, collider->nodes);
+		readVector(des, collider->vertices);
+		readVector(des, collider->indices);
+		des >> collider->origin >> collider->step;
+		return collider;
+	}
+
+	// each message is prefixed with its size
+	void sendFrame(TcpConnection *connection, const MemoryBuffer &buffer)
+	{
+		const uint32 size = numeric_cast<uint32>(buffer.size());
+		connection->write({ (const char *)&size, (const char *)(&size + 1) });
+		connection->write(buffer);
+	}
+
+	// polls until the bytes are available, deadline zero waits indefinitely
+	void waitAvailable(TcpConnection *connection, uintPtr size, uint64 deadline)
+	{
+		if (deadline == 0)
+			return; // the read blocks
+		while (connection->available() < size)
+		{
+			if (applicationTime() > deadline)
+				CAGE_THROW_ERROR(Exception, "terrain worker has not answered in time");
+			threadSleep(1000);
+		}
+	}
+
+	Holder<PointerRange<char>> receiveFrame(TcpConnection *connection, uint64 deadline)
+	{
+		uint32 size = 0;
+		waitAvailable(connection, sizeof(size), deadline);
+		connection->read({ (char *)&size, (char *)(&size + 1) });
+		if (size > MaxFrameSize)
+			CAGE_THROW_ERROR(Exception, "terrain worker message is too large");
+		waitAvailable(connection, size, deadline);
+		return connection->read(size);
+	}
+
+	/////////////////////////////////////////////////////////////////////////////
+	// CLIENT
+	/////////////////////////////////////////////////////////////////////////////
+
+	struct Worker
+	{
+		Holder<TcpConnection> connection;
+		uint64 retryTime = 0;
+		bool failed = false; // reported already
+	};
+
+	// indexed by the generator thread, so that each worker is used by one thread only
+	std::array<Worker, 64> workers;
+
+	void workerFailed(uint32 index, Worker &w)
+	{
+		w.connection.clear();
+		w.retryTime = applicationTime() + ReconnectDelay;
+		if (!w.failed)
+			CAGE_LOG(SeverityEnum::Warning, "terrainRemote", Stringizer() + "terrain worker " + index + " is not available, generating in process");
+		w.failed = true;
+	}
+
+	TcpConnection *workerConnection(uint32 index)
+	{
+		if (index >= min((uint32)max(sint32(confWorkersCount), 0), numeric_cast<uint32>(workers.size())))
+			return nullptr;
+		Worker &w = workers[index];
+		if (w.connection)
+			return +w.connection;
+		if (applicationTime() < w.retryTime)
+			return nullptr;
+		try
+		{
+			const String address = confWorkersAddress;
+			w.connection = newTcpConnection(address, numeric_cast<uint16>(sint32(confWorkersPort) + index));
+			TerrainRemoteJob hello;
+			hello.type = TerrainRemoteMessageEnum::Hello;
+			hello.seed = terrainSeed();
+			terrainRemoteSend(+w.connection, hello);
+			TerrainRemoteResult ack;
+			terrainRemoteReceive(+w.connection, ack);
+			if (ack.type != TerrainRemoteMessageEnum::Result)
+				CAGE_THROW_ERROR(Exception, "terrain worker uses different seed");
+		}
+		catch (...)
+		{
+			workerFailed(index, w);
+			return nullptr;
+		}
+		CAGE_LOG(SeverityEnum::Info, "terrainRemote", Stringizer() + "connected to terrain worker " + index);
+		w.failed = false;
+		return +w.connection;
+	}
+
+	bool workerRequest(uint32 index, const TerrainRemoteJob &job, TerrainRemoteResult &result)
+	{
+		TcpConnection *connection = workerConnection(index);
+		if (!connection)
+			return false;
+		try
+		{
+			terrainRemoteSend(connection, job);
+			terrainRemoteReceive(connection, result);
+		}
+		catch (...)
+		{
+			workerFailed(index, workers[index]);
+			return false;
+		}
+		// the worker has survived, but the generator has thrown, try this tile in process
+		return result.type == TerrainRemoteMessageEnum::Result;
+	}
+
+}
+
+bool terrainRemoteWorker(uint32 worker)
+{
+	if (worker >= min((uint32)max(sint32(confWorkersCount), 0), numeric_cast<uint32>(workers.size())))
+		return false;
+	if (!workers[worker].failed)
+		return true;
+	// reconnects once the retry delay has passed, so that a restarted worker is picked up even by an idle thread
+	return workerConnection(worker) != nullptr;
+}
+
+bool terrainRemoteGenerate(uint32 worker, const TilePos &tilePos, const PlayerView &view, std::vector<TerrainPart> &parts, uint32 &meshResolution, Holder<Image> &albedo, Holder<Image> &special)
+{
+	TerrainRemoteJob job;
+	job.type = TerrainRemoteMessageEnum::Tile;
+	job.tilePos = tilePos;
+	job.view = view;
+	TerrainRemoteResult result;
+	if (!workerRequest(worker, job, result))
+		return false;
+	for (uint32 i = 0; i < (uint32)TileMetricEnum::Count; i++)
+		if (result.durations[i])
+			terrainMetricsRecord((TileMetricEnum)i, tilePos.radius, result.durations[i]);
+	parts = std::move(result.parts);
+	meshResolution = result.meshResolution;
+	albedo = std::move(result.albedo);
+	special = std::move(result.special);
+	return true;
+}
+
+bool terrainRemoteGenerateCollider(uint32 worker, const TilePos &tilePos, uint32 meshResolution, Holder<TileCollider> &collider)
+{
+	TerrainRemoteJob job;
+	job.type = TerrainRemoteMessageEnum::Collider;
+	job.tilePos = tilePos;
+	job.meshResolution = meshResolution;
+	TerrainRemoteResult result;
+	if (!workerRequest(worker, job, result))
+		return false;
+	collider = std::move(result.collider);
+	return true;
+}
+
+void terrainRemoteSend(TcpConnection *connection, const TerrainRemoteJob &job)
+{
+	MemoryBuffer buf;
+	Serializer ser(buf);
+	ser << ProtocolMagic << ProtocolVersion << job.type;
+	switch (job.type)
+	{
+		case TerrainRemoteMessageEnum::Hello:
+			ser << job.seed;
+			break;
+		case TerrainRemoteMessageEnum::Tile:
+		case TerrainRemoteMessageEnum::Collider:
+			ser << job.tilePos.pos << job.tilePos.radius << job.view.position << job.view.viewScale << job.meshResolution;
+			break;
+		default:
+			CAGE_THROW_CRITICAL(Exception, "invalid terrain job type");
+	}
+	sendFrame(connection, buf);
+}
+
+void terrainRemoteSend(TcpConnection *connection, const TerrainRemoteResult &result)
+{
+	MemoryBuffer buf;
+	Serializer ser(buf);
+	ser << ProtocolMagic << ProtocolVersion << result.type;
+	if (result.type == TerrainRemoteMessageEnum::Result)
+	{
+		ser << result.meshResolution;
+		for (uint64 d : result.durations)
+			ser << d;
+		ser << numeric_cast<uint32>(result.parts.size());
+		for (const TerrainPart &p : result.parts)
+		{
+			ser << p.material << bool(p.compactMesh);
+			if (p.compactMesh)
+			{
+				writeVector(ser, p.compactMesh->vertices);
+				writeVector(ser, p.compactMesh->indices);
+			}
+			else
+				writeBuffer(ser, *p.mesh->exportBuffer());
+		}
+		writeImage(ser, result.albedo);
+		writeImage(ser, result.special);
+		writeCollider(ser, result.collider);
+	}
+	sendFrame(connection, buf);
+}
+
+void terrainRemoteReceive(TcpConnection *connection, TerrainRemoteJob &job)
+{
+	Holder<PointerRange<char>> frame = receiveFrame(connection, 0); // the worker waits for jobs indefinitely
+	Deserializer des(*frame);
+	uint32 magic = 0, version = 0;
+	des >> magic >> version >> job.type;
+	if (magic != ProtocolMagic || version != ProtocolVersion)
+		CAGE_THROW_ERROR(Exception, "incompatible terrain worker protocol");
+	switch (job.type)
+	{
+		case TerrainRemoteMessageEnum::Hello:
+			des >> job.seed;
+			break;
+		case TerrainRemoteMessageEnum::Tile:
+		case TerrainRemoteMessageEnum::Collider:
+			des >> job.tilePos.pos >> job.tilePos.radius >> job.view.position >> job.view.viewScale >> job.meshResolution;
+			break;
+		default:
+			CAGE_THROW_ERROR(Exception, "invalid terrain job type");
+	}
+}
+
+void terrainRemoteReceive(TcpConnection *connection, TerrainRemoteResult &result)
+{
+	Holder<PointerRange<char>> frame = receiveFrame(connection, applicationTime() + uint64(max(sint32(confWorkersTimeout), 1)) * 1000);
+	Deserializer des(*frame);
+	uint32 magic = 0, version = 0;
+	des >> magic >> version >> result.type;
+	if (magic != ProtocolMagic || version != ProtocolVersion)
+		CAGE_THROW_ERROR(Exception, "incompatible terrain worker protocol");
+	if (result.type != TerrainRemoteMessageEnum::Result)
+		return;
+	des >> result.meshResolution;
+	for (uint64 &d : result.durations)
+		des >> d;
+	uint32 cnt = 0;
+	des >> cnt;
+	result.parts.resize(cnt);
+	for (TerrainPart &p : result.parts)
+	{
+		bool compact = false;
+		des >> p.material >> compact;
+		if (compact)
+		{
+			p.compactMesh = systemMemory().createHolder<TerrainMesh>();
+			readVector(des, p.compactMesh->vertices);
+			readVector(des, p.compactMesh->indices);
+		}
+		else
+		{
+			p.mesh = newMesh();
+			p.mesh->importBuffer(readBuffer(des));
+		}
+	}
+	result.albedo = readImage(des);
+	result.special = readImage(des);
+	result.collider = readCollider(des);
+}
@@ -2,14 +2,17 @@
 #define baseTile_h_dsfg7d8f5
 
 #include "../common.h"
+#include "../frameArena.h"
 
 #include <set>
+#include <vector>
+#include <array>
 
 namespace cage
 {
 	class Mesh;
-	class Collider;
 	class Image;
+	class TcpConnection;
 }
 
 struct TilePos
@@ -20,7 +23,7 @@ struct TilePos
 
 	Aabb getBox() const; // aabb in world space
 	Transform getTransform() const;
-	Real distanceToPlayer() const;
+	Real distanceTo(const Vec3 &point) const;
 	bool operator < (const TilePos &other) const;
 };
 
@@ -29,7 +32,132 @@ inline Stringizer &operator + (Stringizer &s, const TilePos &p)
 	return s + p.radius + "__" + p.pos[0] + "_" + p.pos[1] + "_" + p.pos[2];
 }
 
-std::set<TilePos> findNeededTiles(const std::set<TilePos> &tilesReady);
-void terrainGenerate(const TilePos &tilePos, Holder<Mesh> &mesh, Holder<Collider> &collider, Holder<Image> &albedo, Holder<Image> &special);
+// compact vertex layout for terrain tiles (16 bytes instead of 32)
+// all half floats, which the model attributes handle without normalization, the missing w of the position defaults to one
+struct TerrainVertex
+{
+	uint16 position[3] = {}; // tile local space
+	uint16 normal[3] = {};
+	uint16 uv[2] = {};
+};
+static_assert(sizeof(TerrainVertex) == 16);
+
+// tiles are split into children when the player is closer than this many tile radii
+constexpr sint32 TerrainCoarsenessRadii = 4;
+constexpr sint32 TerrainFinestRadius = 4; // these tiles are never split
+constexpr sint32 TerrainCoarsestRadius = 16; // the top level of the hierarchy
+
+// marching cubes resolution of the tiles, cells per tile edge
+constexpr uint32 TerrainMeshResolutionMin = 8;
+constexpr uint32 TerrainMeshResolutionMax = 24;
+
+// tile positions are within -1 .. 1, half floats round them by at most half of their ulp at one
+constexpr float TerrainVertexPositionBound = 1 + 1.0f / 2048;
+
+struct TerrainMesh
+{
+	std::vector<TerrainVertex> vertices;
+	std::vector<uint32> indices;
+};
+
+struct MeshOptimizeStatistics
+{
+	Real acmrBefore; // average cache miss ratio (vertex shader invocations per triangle)
+	Real acmrAfter;
+};
+
+// reorders triangles for the post-transform vertex cache and vertices for memory locality of the fetches
+MeshOptimizeStatistics meshOptimizeVertexCache(Mesh *mesh);
+
+enum class TerrainMaterialEnum : uint32
+{
+	Unique = 0, // textures unwrapped for the particular tile
+	TriplanarX, // shared world-aligned textures projected along the axis
+	TriplanarY,
+	TriplanarZ,
+	Palette, // flat per-face colors, the uvs point into a shared palette of all quantized materials
+};
+
+// materials with textures shared by all tiles
+constexpr uint32 TerrainSharedMaterialsCount = 4;
+constexpr TerrainMaterialEnum TerrainSharedMaterials[TerrainSharedMaterialsCount] = { TerrainMaterialEnum::TriplanarX, TerrainMaterialEnum::TriplanarY, TerrainMaterialEnum::TriplanarZ, TerrainMaterialEnum::Palette };
+
+struct TerrainPart
+{
+	Holder<Mesh> mesh; // full precision mesh, when compact vertices are disabled
+	Holder<TerrainMesh> compactMesh;
+	TerrainMaterialEnum material = TerrainMaterialEnum::Unique;
+};
+
+// must be called once, before any generation, the same seed always yields the same terrain
+void terrainInitialize(uint32 seed);
+uint32 terrainSeed();
+
+FrameSet<TilePos> findNeededTiles(const FrameSet<TilePos> &tilesReady); // allocated in the frame arena
+void terrainGenerate(const TilePos &tilePos, const PlayerView &view, std::vector<TerrainPart> &parts, uint32 &meshResolution, Holder<Image> &albedo, Holder<Image> &special);
+enum class TileMetricEnum : uint32
+{
+	QueueWait, // requested until picked by a generator
+	GenerateMesh,
+	GenerateUnwrap,
+	GenerateMaterial, // vertex colors, triplanar parts or unique textures
+	Collider,
+	UploadWait, // generated until uploaded to the gpu
+	Total, // requested until ready
+	Count
+};
+
+// durations are in microseconds, recording is thread safe
+void terrainMetricsRecord(TileMetricEnum metric, sint32 radius, uint64 duration);
+void terrainMetricsQueues(uint32 generate, uint32 upload, uint32 colliders, uint32 freeSlots);
+void terrainMetricsGenerators(uint32 count);
+void terrainMetricsGeneratorBusy(uint64 duration);
+
+// regenerates the same surface as the mesh of the tile, with the same resolution
+Holder<TileCollider> terrainGenerateCollider(const TilePos &tilePos, uint32 meshResolution);
+void terrainGenerateSharedMaterial(TerrainMaterialEnum material, Holder<Image> &albedo, Holder<Image> &special);
+
+// generation in flittermouse-tilegen worker processes, over local tcp
+// each generator thread uses its own worker, selected by the thread index
+// returns false if the worker is disabled, unreachable, or has failed, the caller then generates in process
+bool terrainRemoteGenerate(uint32 worker, const TilePos &tilePos, const PlayerView &view, std::vector<TerrainPart> &parts, uint32 &meshResolution, Holder<Image> &albedo, Holder<Image> &special);
+bool terrainRemoteGenerateCollider(uint32 worker, const TilePos &tilePos, uint32 meshResolution, Holder<TileCollider> &collider);
+bool terrainRemoteWorker(uint32 worker); // the worker is configured and connected, or reconnects it after a failure, call from the generator thread of the worker only
+
+enum class TerrainRemoteMessageEnum : uint32
+{
+	Hello, // the worker initializes the terrain with the seed, or fails if it already uses another one
+	Tile,
+	Collider,
+	Result,
+	Failure,
+};
+
+struct TerrainRemoteJob
+{
+	TerrainRemoteMessageEnum type = TerrainRemoteMessageEnum::Hello;
+	uint32 seed = 0;
+	TilePos tilePos;
+	PlayerView view; // the detail of the tile depends on the view
+	uint32 meshResolution = 0; // colliders only
+};
+
+struct TerrainRemoteResult
+{
+	TerrainRemoteMessageEnum type = TerrainRemoteMessageEnum::Result;
+	std::vector<TerrainPart> parts;
+	Holder<Image> albedo;
+	Holder<Image> special;
+	Holder<TileCollider> collider;
+	uint32 meshResolution = 0;
+	uint64 durations[(uint32)TileMetricEnum::Count] = {}; // stages measured by the worker
+};
+
+// blocking, throws when the connection is closed or the data are malformed
+// receiving a result also throws when the worker does not answer in time
+void terrainRemoteSend(TcpConnection *connection, const TerrainRemoteJob &job);
+void terrainRemoteSend(TcpConnection *connection, const TerrainRemoteResult &result);
+void terrainRemoteReceive(TcpConnection *connection, TerrainRemoteJob &job);
+void terrainRemoteReceive(TcpConnection *connection, TerrainRemoteResult &result);
 
 #endif // !baseTile_h_dsfg7d8f5
@@ -1,4 +1,8 @@
 #include "terrain.h"
+#include "../tileCollider.h"
+#include "../profiler.h"
+#include "../tickBudget.h"
+#include "../threadPlacement.h"
 
 #include <cage-core/entities.h>
 #include <cage-core/concurrent.h>
@@ -6,6 +10,8 @@
 #include <cage-core/debug.h>
 #include <cage-core/meshImport.h>
 #include <cage-core/serialization.h>
+#include <cage-core/config.h>
+#include <cage-core/random.h>
 #include <cage-engine/scene.h>
 #include <cage-engine/opengl.h>
 #include <cage-engine/assetStructs.h>
@@ -13,14 +19,28 @@
 #include <cage-engine/texture.h>
 #include <cage-engine/renderObject.h>
 #include <cage-engine/graphicsError.h>
+#include <cage-engine/shaderConventions.h>
 #include <cage-simple/engine.h>
 
 #include <vector>
 #include <array>
 #include <atomic>
+#include <cstddef> // offsetof
 
 namespace
 {
+	const ConfigUint32 confSeed("flittermouse/terrain/seed", 0); // zero for a random seed
+
+	// colliders are built lazily, only for tiles this close to the player
+	const ConfigFloat confColliderRadius("flittermouse/collision/radius", 30);
+
+	// the number of working generators adapts to the headroom of the control tick and of the rendered frames
+	const ConfigFloat confGeneratorsHeadroom("flittermouse/terrain/generators/headroom", 0.25); // fraction of the control tick that should stay free
+	const ConfigSint32 confGeneratorsFramePeriod("flittermouse/terrain/generators/framePeriod", 0); // microseconds of the target frame, zero to follow the fastest sustained frame interval
+	const ConfigFloat confGeneratorsFrameSlack("flittermouse/terrain/generators/frameSlack", 0.15); // fraction by which frames may exceed the target period before they are considered tight
+	const ConfigBool confGeneratorsLowPriority("flittermouse/terrain/generators/lowPriority", true); // lower the priority of the generators while the frames or ticks are tight
+	const ConfigBool confGeneratorsAffinity("flittermouse/terrain/generators/affinity", false);
+
 	enum class TileStateEnum
 	{
 		Init,
@@ -31,11 +51,18 @@ namespace
 		Ready,
 	};
 
+	enum class ColliderStateEnum
+	{
+		None,
+		Requested,
+		Generating,
+		Ready,
+	};
+
 	struct TileBase
 	{
-		Holder<Collider> cpuCollider;
-		Holder<Mesh> cpuMesh;
-		Holder<Model> gpuMesh;
+		Holder<TileCollider> cpuCollider;
+		std::vector<TerrainPart> cpuParts;
 		Holder<Image> cpuAlbedo;
 		Holder<Texture> gpuAlbedo;
 		Holder<Image> cpuSpecial;
@@ -43,33 +70,66 @@ namespace
 		Holder<RenderObject> renderObject;
 		TilePos pos;
 		Entity *entity = nullptr;
-		uint32 meshName = 0;
-		uint32 albedoName = 0;
+		std::vector<uint32> meshNames; // one per part
+		uint32 albedoName = 0; // zero if the tile has no textures of its own
 		uint32 specialName = 0;
 		uint32 objectName = 0;
-
-		Real distanceToPlayer() const
-		{
-			return pos.distanceToPlayer();
-		}
+		uint32 sharedMaterials = 0; // bitmask of the shared materials used by the parts
+		uint32 meshResolution = 0; // needed to generate the collider later
+		bool colliderRegistered = false;
+		uint64 requestTime = 0; // timestamps for the metrics
+		uint64 generatedTime = 0;
 	};
 
 	struct Tile : public TileBase
 	{
 		std::atomic<TileStateEnum> status {TileStateEnum::Init};
+		std::atomic<ColliderStateEnum> colliderStatus {ColliderStateEnum::None};
 	};
 
 	std::vector<Holder<Thread>> generatorThreads;
+	std::atomic<uint32> generatorsStarted {0}; // assigns indices to the threads
+	std::atomic<uint32> generatorsActive {1}; // threads with higher index are idle
+	std::atomic<uint64> dispatchInterval {0}; // microseconds, moving average
+	uint64 lastDispatchTime = 0;
+	uint64 measuredFramePeriod = 0; // microseconds, control thread only
+	std::atomic<bool> generatorsLowered {false};
+	uint64 lastAdaptTime = 0;
 	std::array<Tile, 4096> tiles;
 	std::atomic<bool> stopping;
 
+	// textures shared by all tiles, each generated once when first needed
+	struct SharedMaterial
+	{
+		Holder<Image> cpuAlbedo;
+		Holder<Image> cpuSpecial;
+		uint32 albedoName = 0;
+		uint32 specialName = 0;
+		std::atomic<TileStateEnum> status {TileStateEnum::Init};
+	};
+	std::array<SharedMaterial, TerrainSharedMaterialsCount> sharedMaterials;
+
+	uint32 sharedMaterialIndex(TerrainMaterialEnum material)
+	{
+		CAGE_ASSERT(material != TerrainMaterialEnum::Unique);
+		return (uint32)material - (uint32)TerrainMaterialEnum::TriplanarX;
+	}
+
+	bool sharedMaterialsReady(uint32 mask)
+	{
+		for (uint32 i = 0; i < TerrainSharedMaterialsCount; i++)
+			if ((mask & (1u << i)) && sharedMaterials[i].status != TileStateEnum::Ready)
+				return false;
+		return true;
+	}
+
 	/////////////////////////////////////////////////////////////////////////////
 	// CONTROL
 	/////////////////////////////////////////////////////////////////////////////
 
-	std::set<TilePos> findReadyTiles()
+	FrameSet<TilePos> findReadyTiles()
 	{
-		std::set<TilePos> readyTiles;
+		FrameSet<TilePos> readyTiles;
 		for (Tile &t : tiles)
 		{
 			if (t.status == TileStateEnum::Ready)
@@ -78,10 +138,57 @@ namespace
 		return readyTiles;
 	}
 
+	void adaptGenerators(bool demand)
+	{
+		const uint64 now = applicationTime();
+		if (now < lastAdaptTime + 500000)
+			return;
+		lastAdaptTime = now;
+
+		// the fastest sustained interval approximates the display period, it drifts slowly upwards in case the display changes
+		const uint64 interval = dispatchInterval;
+		if (interval)
+			measuredFramePeriod = measuredFramePeriod ? min(measuredFramePeriod + measuredFramePeriod / 100, interval) : interval;
+		const uint64 period = confGeneratorsFramePeriod > 0 ? uint64(sint32(confGeneratorsFramePeriod)) : measuredFramePeriod;
+
+		const uint32 current = generatorsActive;
+		const uint32 maximum = numeric_cast<uint32>(generatorThreads.size());
+		const bool controlTight = tickBudgetUtilization() > 1 - Real(confGeneratorsHeadroom);
+		const bool frameTight = period && interval > period + numeric_cast<uint64>(period * Real(confGeneratorsFrameSlack).value);
+		generatorsLowered = confGeneratorsLowPriority && (controlTight || frameTight);
+		uint32 next = current;
+		if (controlTight || frameTight)
+			next = max(current, 2u) - 1;
+		else if (demand)
+			next = min(current + 1, maximum);
+		if (next != current)
+		{
+			generatorsActive = next;
+			terrainMetricsGenerators(next);
+		}
+	}
+
+	TickBudget tickBudget("tiles");
+
+	// resets the collider state, unless a generator has started on it, in which case the removal is postponed
+	bool claimCollider(Tile &t)
+	{
+		ColliderStateEnum expected = t.colliderStatus;
+		while (expected != ColliderStateEnum::Generating)
+		{
+			if (t.colliderStatus.compare_exchange_weak(expected, ColliderStateEnum::None))
+				return true;
+		}
+		return false;
+	}
+
 	void engineUpdate()
 	{
+		TickBudgetScope budgetScope(tickBudget);
+		FLITTERMOUSE_PROFILE("tiles update");
 		AssetManager *ass = engineAssets();
-		std::set<TilePos> neededTiles = stopping ? std::set<TilePos>() : findNeededTiles(findReadyTiles());
+		FrameSet<TilePos> neededTiles = stopping ? FrameSet<TilePos>() : findNeededTiles(findReadyTiles());
+		uint32 queueGenerate = 0, queueUpload = 0, queueColliders = 0, freeSlots = 0;
 		for (Tile &t : tiles)
 		{
 			bool visible = false;
@@ -100,19 +207,23 @@ namespace
 			}
 
 			// remove tiles
-			if (t.status == TileStateEnum::Ready && (!requested || stopping))
+			if (t.status == TileStateEnum::Ready && (!requested || stopping) && claimCollider(t))
 			{
 				if (t.entity)
 				{
-					ass->remove(t.meshName);
-					ass->remove(t.albedoName);
-					ass->remove(t.specialName);
+					for (uint32 n : t.meshNames)
+						ass->remove(n);
+					if (t.albedoName)
+					{
+						ass->remove(t.albedoName);
+						ass->remove(t.specialName);
+					}
 					ass->remove(t.objectName);
 					t.entity->destroy();
 				}
-				if (t.pos.visible)
+				if (t.colliderRegistered)
 					terrainRemoveCollider(t.objectName);
-				(TileBase&)t = TileBase();
+				(TileBase&)t = TileBase(); // the collider state is reset by the claim
 				t.status = TileStateEnum::Init;
 			}
 
@@ -126,33 +237,79 @@ namespace
 				}
 
 				t.status = TileStateEnum::Ready;
+				terrainMetricsRecord(TileMetricEnum::Total, t.pos.radius, applicationTime() - t.requestTime);
 			}
 
 			if (t.entity)
 			{
 				CAGE_ASSERT(t.status == TileStateEnum::Ready);
-				CAGE_ASSERT(!!t.cpuCollider);
 				if (t.pos.visible != visible)
 				{
 					if (visible)
 					{
-						terrainAddCollider(t.objectName, t.cpuCollider.share(), t.pos.getTransform());
 						RenderComponent &r = t.entity->value<RenderComponent>();
 						r.object = t.objectName;
 					}
 					else
-					{
-						terrainRemoveCollider(t.objectName);
 						t.entity->remove<RenderComponent>();
-					}
 					t.pos.visible = visible;
 				}
+
+				// request or free the collider
+				const bool near = t.pos.distanceTo(playerPosition) < Real(confColliderRadius);
+				if (near && t.colliderStatus == ColliderStateEnum::None)
+					t.colliderStatus = ColliderStateEnum::Requested;
+				else if (!near && t.colliderStatus == ColliderStateEnum::Requested)
+				{
+					ColliderStateEnum expected = ColliderStateEnum::Requested;
+					t.colliderStatus.compare_exchange_strong(expected, ColliderStateEnum::None); // a generator may have picked it already
+				}
+				else if (!near && t.colliderStatus == ColliderStateEnum::Ready)
+				{
+					if (t.colliderRegistered)
+						terrainRemoveCollider(t.objectName);
+					t.colliderRegistered = false;
+					t.cpuCollider.clear();
+					t.colliderStatus = ColliderStateEnum::None;
+				}
+
+				// only visible tiles participate in queries
+				const bool registered = visible && t.colliderStatus == ColliderStateEnum::Ready && t.cpuCollider;
+				if (t.colliderRegistered != registered)
+				{
+					if (registered)
+						terrainAddCollider(t.objectName, t.cpuCollider.share(), t.pos.getTransform());
+					else
+						terrainRemoveCollider(t.objectName);
+					t.colliderRegistered = registered;
+				}
 			}
 			else
 				t.pos.visible = false;
+
+			switch (t.status)
+			{
+				case TileStateEnum::Init: freeSlots++; break;
+				case TileStateEnum::Generate: queueGenerate++; break;
+				case TileStateEnum::Upload: queueUpload++; break;
+				default: break;
+			}
+			if (t.colliderStatus == ColliderStateEnum::Requested)
+				queueColliders++;
 		}
+		terrainMetricsQueues(queueGenerate, queueUpload, queueColliders, freeSlots);
 
-		terrainRebuildColliders();
+		if (stopping)
+		{
+			for (SharedMaterial &s : sharedMaterials)
+			{
+				if (s.status != TileStateEnum::Ready)
+					continue;
+				ass->remove(s.albedoName);
+				ass->remove(s.specialName);
+				s.status = TileStateEnum::Init;
+			}
+		}
 
 		// generate new needed tiles
 		for (Tile &t : tiles)
@@ -163,6 +320,7 @@ namespace
 			{
 				t.pos = *neededTiles.begin();
 				neededTiles.erase(neededTiles.begin());
+				t.requestTime = applicationTime();
 				t.status = TileStateEnum::Generate;
 			}
 		}
@@ -172,6 +330,8 @@ namespace
 			CAGE_LOG(SeverityEnum::Warning, "flittermouse", "not enough terrain tile slots");
 			detail::debugBreakpoint();
 		}
+
+		adaptGenerators(queueGenerate + queueColliders > 0);
 	}
 
 	void engineFinalize()
@@ -184,12 +344,12 @@ namespace
 	// DISPATCH
 	/////////////////////////////////////////////////////////////////////////////
 
-	Holder<Texture> dispatchTexture(Holder<Image> &image)
+	Holder<Texture> dispatchTexture(Holder<Image> &image, uint32 wrap = GL_CLAMP_TO_EDGE, uint32 filter = GL_LINEAR)
 	{
 		Holder<Texture> t = newTexture();
 		t->importImage(+image);
-		t->filters(GL_LINEAR, GL_LINEAR, 100);
-		t->wraps(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+		t->filters(filter, filter, filter == GL_NEAREST ? 0 : 100);
+		t->wraps(wrap, wrap);
 		image.clear();
 		return t;
 	}
@@ -203,26 +363,91 @@ namespace
 		return m;
 	}
 
+	Holder<Model> dispatchMesh(Holder<TerrainMesh> &poly)
+	{
+		Holder<Model> m = newModel();
+		MeshImportMaterial mat;
+		const PointerRange<const char> vertices = { (const char *)poly->vertices.data(), (const char *)(poly->vertices.data() + poly->vertices.size()) };
+		m->setPrimitiveType(GL_TRIANGLES);
+		m->setBuffers(numeric_cast<uint32>(poly->vertices.size()), sizeof(TerrainVertex), vertices, poly->indices, bufferView(mat));
+		m->setAttribute(CAGE_SHADER_ATTRIB_IN_POSITION, 3, GL_HALF_FLOAT, sizeof(TerrainVertex), offsetof(TerrainVertex, position));
+		m->setAttribute(CAGE_SHADER_ATTRIB_IN_NORMAL, 3, GL_HALF_FLOAT, sizeof(TerrainVertex), offsetof(TerrainVertex, normal));
+		m->setAttribute(CAGE_SHADER_ATTRIB_IN_UV, 2, GL_HALF_FLOAT, sizeof(TerrainVertex), offsetof(TerrainVertex, uv));
+		m->boundingBox = Aabb(Vec3(-TerrainVertexPositionBound), Vec3(TerrainVertexPositionBound));
+		poly.clear();
+		return m;
+	}
+
+	void dispatchSharedMaterials()
+	{
+		AssetManager *ass = engineAssets();
+		for (uint32 i = 0; i < TerrainSharedMaterialsCount; i++)
+		{
+			SharedMaterial &s = sharedMaterials[i];
+			if (s.status != TileStateEnum::Upload)
+				continue;
+			FLITTERMOUSE_PROFILE("shared material upload");
+			// the palette must not blend neighboring entries, the triplanar textures repeat
+			const bool palette = TerrainSharedMaterials[i] == TerrainMaterialEnum::Palette;
+			const uint32 wrap = palette ? GL_CLAMP_TO_EDGE : GL_REPEAT;
+			const uint32 filter = palette ? GL_NEAREST : GL_LINEAR;
+			ass->fabricate<AssetSchemeIndexTexture, Texture>(s.albedoName, dispatchTexture(s.cpuAlbedo, wrap, filter), Stringizer() + "shared albedo " + i);
+			ass->fabricate<AssetSchemeIndexTexture, Texture>(s.specialName, dispatchTexture(s.cpuSpecial, wrap, filter), Stringizer() + "shared special " + i);
+			s.status = TileStateEnum::Ready;
+		}
+	}
+
 	void engineDispatch()
 	{
+		FLITTERMOUSE_PROFILE("tiles dispatch");
+		{
+			const uint64 now = applicationTime();
+			if (lastDispatchTime)
+				dispatchInterval = (dispatchInterval * 15 + (now - lastDispatchTime)) / 16;
+			lastDispatchTime = now;
+		}
 		AssetManager *ass = engineAssets();
 		CAGE_CHECK_GL_ERROR_DEBUG();
+		dispatchSharedMaterials();
 		for (Tile &t : tiles)
 		{
 			if (t.status == TileStateEnum::Upload)
 			{
-				t.gpuAlbedo = dispatchTexture(t.cpuAlbedo);
-				t.gpuSpecial = dispatchTexture(t.cpuSpecial);
-				t.gpuMesh = dispatchMesh(t.cpuMesh);
-				t.gpuMesh->textureNames[0] = t.albedoName;
-				t.gpuMesh->textureNames[1] = t.specialName;
+				if (!sharedMaterialsReady(t.sharedMaterials))
+					continue;
+				FLITTERMOUSE_PROFILE("tile upload");
+
+				if (t.albedoName)
+				{
+					t.gpuAlbedo = dispatchTexture(t.cpuAlbedo);
+					t.gpuSpecial = dispatchTexture(t.cpuSpecial);
+					ass->fabricate<AssetSchemeIndexTexture, Texture>(t.albedoName, std::move(t.gpuAlbedo), Stringizer() + "albedo " + t.pos);
+					ass->fabricate<AssetSchemeIndexTexture, Texture>(t.specialName, std::move(t.gpuSpecial), Stringizer() + "special " + t.pos);
+				}
+
+				for (uint32 i = 0; i < t.cpuParts.size(); i++)
+				{
+					TerrainPart &p = t.cpuParts[i];
+					Holder<Model> model = p.compactMesh ? dispatchMesh(p.compactMesh) : dispatchMesh(p.mesh);
+					if (p.material == TerrainMaterialEnum::Unique)
+					{
+						model->textureNames[0] = t.albedoName;
+						model->textureNames[1] = t.specialName;
+					}
+					else
+					{
+						const SharedMaterial &s = sharedMaterials[sharedMaterialIndex(p.material)];
+						model->textureNames[0] = s.albedoName;
+						model->textureNames[1] = s.specialName;
+					}
+					ass->fabricate<AssetSchemeIndexModel, Model>(t.meshNames[i], std::move(model), Stringizer() + "mesh " + t.pos + " " + i);
+				}
+				t.cpuParts.clear();
 
 				// transfer asset ownership
-				ass->fabricate<AssetSchemeIndexTexture, Texture>(t.albedoName, std::move(t.gpuAlbedo), Stringizer() + "albedo " + t.pos);
-				ass->fabricate<AssetSchemeIndexTexture, Texture>(t.specialName, std::move(t.gpuSpecial), Stringizer() + "special " + t.pos);
-				ass->fabricate<AssetSchemeIndexModel, Model>(t.meshName, std::move(t.gpuMesh), Stringizer() + "mesh " + t.pos);
 				ass->fabricate<AssetSchemeIndexRenderObject, RenderObject>(t.objectName, std::move(t.renderObject), Stringizer() + "object " + t.pos);
 
+				terrainMetricsRecord(TileMetricEnum::UploadWait, t.pos.radius, applicationTime() - t.generatedTime);
 				t.status = TileStateEnum::Entity;
 				break;
 			}
@@ -238,61 +463,169 @@ namespace
 	{
 		static Holder<Mutex> mut = newMutex();
 		ScopeLock<Mutex> lock(mut);
+		const Vec3 player = playerViewSnapshot().position;
 		Tile *result = nullptr;
+		Real resultDistance;
 		for (Tile &t : tiles)
 		{
 			if (t.status != TileStateEnum::Generate)
 				continue;
+			const Real d = t.pos.distanceTo(player);
 			if (result)
 			{
 				if (t.pos.radius < result->pos.radius)
 					continue;
-				if (t.distanceToPlayer() > result->distanceToPlayer())
+				if (d > resultDistance)
 					continue;
 			}
 			result = &t;
+			resultDistance = d;
 		}
 		if (result)
+		{
 			result->status = TileStateEnum::Generating;
+			terrainMetricsRecord(TileMetricEnum::QueueWait, result->pos.radius, applicationTime() - result->requestTime);
+		}
 		return result;
 	}
 
+	// colliders have lower priority than any tile waiting for its mesh
+	Tile *generatorChooseCollider()
+	{
+		static Holder<Mutex> mut = newMutex();
+		ScopeLock<Mutex> lock(mut);
+		const Vec3 player = playerViewSnapshot().position;
+		Tile *result = nullptr;
+		Real resultDistance;
+		for (Tile &t : tiles)
+		{
+			if (t.colliderStatus != ColliderStateEnum::Requested)
+				continue;
+			const Real d = t.pos.distanceTo(player);
+			if (result && d > resultDistance)
+				continue;
+			result = &t;
+			resultDistance = d;
+		}
+		if (result)
+		{
+			ColliderStateEnum expected = ColliderStateEnum::Requested;
+			if (!result->colliderStatus.compare_exchange_strong(expected, ColliderStateEnum::Generating))
+				return nullptr; // the tile has left the radius meanwhile
+		}
+		return result;
+	}
+
+	void generateCollider(uint32 index, Tile &t)
+	{
+		FLITTERMOUSE_PROFILE("tile collider");
+		const uint64 start = applicationTime();
+		if (!terrainRemoteGenerateCollider(index, t.pos, t.meshResolution, t.cpuCollider))
+			t.cpuCollider = terrainGenerateCollider(t.pos, t.meshResolution);
+		terrainMetricsRecord(TileMetricEnum::Collider, t.pos.radius, applicationTime() - start);
+		t.colliderStatus = ColliderStateEnum::Ready;
+	}
+
 	void generateRenderObject(Tile &t)
 	{
 		t.renderObject = newRenderObject();
 		Real thresholds[1] = { 0 };
-		uint32 meshIndices[2] = { 0, 1 };
-		uint32 meshNames[1] = { t.meshName };
-		t.renderObject->setLods(thresholds, meshIndices, meshNames);
+		uint32 meshIndices[2] = { 0, numeric_cast<uint32>(t.meshNames.size()) };
+		t.renderObject->setLods(thresholds, meshIndices, t.meshNames);
+	}
+
+	void generateSharedMaterials(uint32 mask)
+	{
+		for (uint32 i = 0; i < TerrainSharedMaterialsCount; i++)
+		{
+			if ((mask & (1u << i)) == 0)
+				continue;
+			SharedMaterial &s = sharedMaterials[i];
+			TileStateEnum expected = TileStateEnum::Init;
+			if (!s.status.compare_exchange_strong(expected, TileStateEnum::Generating))
+				continue; // already generated or being generated by another thread
+			terrainGenerateSharedMaterial(TerrainSharedMaterials[i], s.cpuAlbedo, s.cpuSpecial);
+			s.status = TileStateEnum::Upload;
+		}
 	}
 
 	void generatorEntry()
 	{
+		const uint32 index = generatorsStarted++;
+		if (confGeneratorsAffinity)
+		{
+			// the first two cores are left for the control and graphics threads
+			// threads beyond the remaining processors are not pinned, so that they never share the reserved ones exclusively
+			const std::vector<uint32> order = logicalProcessorsByCore();
+			if (index + 2 < order.size())
+				threadPinToProcessor(order[index + 2]);
+		}
+
 		AssetManager *ass = engineAssets();
+		bool lowered = false;
+		bool priorityFailed = false; // do not retry after the system has refused
 		while (!stopping)
 		{
+			if (!priorityFailed && lowered != generatorsLowered)
+			{
+				lowered = !lowered;
+				priorityFailed = !threadLowPriority(lowered);
+			}
+
+			// threads with a worker offload the work to other processes, so they keep running regardless of the local load
+			if (index >= generatorsActive && !terrainRemoteWorker(index))
+			{
+				threadSleep(10000);
+				continue;
+			}
+
 			Tile *t = generatorChooseTile();
 			if (!t)
 			{
+				if (Tile *c = generatorChooseCollider())
+				{
+					const uint64 start = applicationTime();
+					generateCollider(index, *c);
+					terrainMetricsGeneratorBusy(applicationTime() - start);
+					continue;
+				}
 				threadSleep(10000);
 				continue;
 			}
 
-			terrainGenerate(t->pos, t->cpuMesh, t->cpuCollider, t->cpuAlbedo, t->cpuSpecial);
-			if (!t->cpuMesh)
+			FLITTERMOUSE_PROFILE("tile generate");
+			const uint64 start = applicationTime();
+			const PlayerView view = playerViewSnapshot();
+			if (!terrainRemoteGenerate(index, t->pos, view, t->cpuParts, t->meshResolution, t->cpuAlbedo, t->cpuSpecial))
+				terrainGenerate(t->pos, view, t->cpuParts, t->meshResolution, t->cpuAlbedo, t->cpuSpecial);
+			if (t->cpuParts.empty())
 			{
+				terrainMetricsGeneratorBusy(applicationTime() - start);
+				terrainMetricsRecord(TileMetricEnum::Total, t->pos.radius, applicationTime() - t->requestTime);
 				t->status = TileStateEnum::Ready;
 				continue;
 			}
 
 			// assets names
-			t->albedoName = ass->generateUniqueName();
-			t->specialName = ass->generateUniqueName();
-			t->meshName = ass->generateUniqueName();
+			if (t->cpuAlbedo)
+			{
+				t->albedoName = ass->generateUniqueName();
+				t->specialName = ass->generateUniqueName();
+			}
+			for (const TerrainPart &p : t->cpuParts)
+			{
+				t->meshNames.push_back(ass->generateUniqueName());
+				if (p.material != TerrainMaterialEnum::Unique)
+					t->sharedMaterials |= 1u << sharedMaterialIndex(p.material);
+			}
 			t->objectName = ass->generateUniqueName();
 
+			generateSharedMaterials(t->sharedMaterials);
+
 			generateRenderObject(*t);
 
+			t->generatedTime = applicationTime();
+			terrainMetricsGeneratorBusy(t->generatedTime - start);
 			t->status = TileStateEnum::Upload;
 		}
 	}
@@ -303,7 +636,18 @@ namespace
 
 	void engineInitialize()
 	{
+		terrainInitialize(confSeed ? uint32(confSeed) : (uint32)detail::randomGenerator().next());
+
+		AssetManager *ass = engineAssets();
+		for (SharedMaterial &s : sharedMaterials)
+		{
+			s.albedoName = ass->generateUniqueName();
+			s.specialName = ass->generateUniqueName();
+		}
+
 		uint32 cpuCount = max(processorsCount(), 2u) - 1;
+		generatorsActive = max(cpuCount / 2, 1u);
+		terrainMetricsGenerators(generatorsActive);
 		for (uint32 i = 0; i < cpuCount; i++)
 			generatorThreads.push_back(newThread(Delegate<void()>().bind<&generatorEntry>(), Stringizer() + "generator " + i));
 	}
@@ -320,7 +664,7 @@ namespace
 		{
 			engineUpdateListener.attach(controlThread().update);
 			engineUpdateListener.bind<&engineUpdate>();
-			engineInitializeListener.attach(controlThread().initialize);
+			engineInitializeListener.attach(controlThread().initialize, -100); // seed the terrain before anything samples it
 			engineInitializeListener.bind<&engineInitialize>();
 			engineFinalizeListener.attach(controlThread().finalize);
 			engineFinalizeListener.bind<&engineFinalize>();
@@ -0,0 +1,126 @@
+#include "threadPlacement.h"
+
+#include <cage-core/concurrent.h>
+#include <cage-core/files.h>
+#include <cage-core/string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#ifdef CAGE_SYSTEM_WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#ifndef CAGE_SYSTEM_WINDOWS
+namespace
+{
+	uint32 readTopologyValue(const String &path)
+	{
+		if (!pathIsFile(path))
+			return m;
+		Holder<File> f = readFile(path);
+		String line;
+		if (!f->readLine(line))
+			return m;
+		return toUint32(trim(line));
+	}
+}
+#endif
+
+bool threadLowPriority(bool low)
+{
+#ifdef CAGE_SYSTEM_WINDOWS
+	if (!SetThreadPriority(GetCurrentThread(), low ? THREAD_PRIORITY_BELOW_NORMAL : THREAD_PRIORITY_NORMAL))
+#else
+	// unprivileged threads cannot decrease their nice value again, but may switch between these policies freely
+	sched_param param = {};
+	if (pthread_setschedparam(pthread_self(), low ? SCHED_BATCH : SCHED_OTHER, &param) != 0)
+#endif
+	{
+		static std::atomic<bool> reported = false;
+		if (!reported.exchange(true))
+			CAGE_LOG(SeverityEnum::Warning, "threadPlacement", Stringizer() + "failed to " + (low ? "lower" : "restore") + " thread priority");
+		return false;
+	}
+	return true;
+}
+
+std::vector<uint32> logicalProcessorsByCore()
+{
+	struct Logical
+	{
+		uint32 index = 0;
+		uint32 core = 0;
+		uint32 sibling = 0; // order of the logical processor within its core
+	};
+	std::vector<Logical> logicals;
+
+#ifdef CAGE_SYSTEM_WINDOWS
+	DWORD length = 0;
+	GetLogicalProcessorInformation(nullptr, &length);
+	std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	if (!info.empty() && GetLogicalProcessorInformation(info.data(), &length))
+	{
+		uint32 core = 0;
+		for (const auto &i : info)
+		{
+			if (i.Relationship != RelationProcessorCore)
+				continue;
+			uint32 sibling = 0;
+			for (uint32 b = 0; b < sizeof(ULONG_PTR) * 8; b++)
+				if (i.ProcessorMask & ((ULONG_PTR)1 << b))
+					logicals.push_back({ b, core, sibling++ });
+			core++;
+		}
+	}
+#else
+	const uint32 cnt = processorsCount();
+	for (uint32 i = 0; i < cnt; i++)
+	{
+		Logical l;
+		l.index = i;
+		l.core = i;
+		const String dir = Stringizer() + "/sys/devices/system/cpu/cpu" + i + "/topology/";
+		const uint32 package = readTopologyValue(dir + "physical_package_id");
+		const uint32 core = readTopologyValue(dir + "core_id");
+		if (package != m && core != m)
+			l.core = (package << 16) + core + 0x80000000; // distinct from the fallback indices
+		logicals.push_back(l);
+	}
+	// siblings are numbered in order of the logical index
+	for (Logical &l : logicals)
+		for (const Logical &o : logicals)
+			if (o.core == l.core && o.index < l.index)
+				l.sibling++;
+#endif
+
+	std::stable_sort(logicals.begin(), logicals.end(), [](const Logical &a, const Logical &b) {
+		return a.sibling < b.sibling;
+	});
+	std::vector<uint32> res;
+	res.reserve(logicals.size());
+	for (const Logical &l : logicals)
+		res.push_back(l.index);
+	return res;
+}
+
+void threadPinToProcessor(uint32 processor)
+{
+#ifdef CAGE_SYSTEM_WINDOWS
+	if (processor >= sizeof(DWORD_PTR) * 8 || !SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << processor))
+		CAGE_LOG(SeverityEnum::Warning, "threadPlacement", Stringizer() + "failed to set thread affinity to processor: " + processor);
+#else
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(processor, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		CAGE_LOG(SeverityEnum::Warning, "threadPlacement", Stringizer() + "failed to set thread affinity to processor: " + processor);
+#endif
+}
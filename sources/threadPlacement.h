@@ -0,0 +1,13 @@
+#ifndef flittermouse_threadPlacement_h_p6w1z8d4
+#define flittermouse_threadPlacement_h_p6w1z8d4
+
+#include "common.h"
+
+#include <vector>
+
+// platform specific thread placement, failures are logged and otherwise ignored
+bool threadLowPriority(bool low); // for the calling thread, can be switched both ways without privileges, returns false on failure, which is logged once per process
+void threadPinToProcessor(uint32 processor); // for the calling thread
+std::vector<uint32> logicalProcessorsByCore(); // one logical processor of each physical core first, then their siblings
+
+#endif
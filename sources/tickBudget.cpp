@@ -0,0 +1,110 @@
+#include "tickBudget.h"
+#include "frameArena.h"
+
+#include <cage-simple/engine.h>
+
+#include <vector>
+
+namespace
+{
+	std::vector<TickBudget *> &registry()
+	{
+		static std::vector<TickBudget *> r;
+		return r;
+	}
+
+	uint64 tickStart = 0;
+	uint64 lastLogTime = 0;
+	uint32 unloggedOverruns = 0;
+	Real utilization;
+
+	void tickBegin()
+	{
+		tickStart = applicationTime();
+		for (TickBudget *b : registry())
+		{
+			b->current = 0;
+			b->currentAllocations = 0;
+		}
+	}
+
+	void tickEnd()
+	{
+		const uint64 total = applicationTime() - tickStart;
+		const uint64 period = controlThread().updatePeriod();
+		if (period)
+			utilization = interpolate(utilization, Real(double(total) / double(period)), 0.1);
+		TickBudget *worst = nullptr;
+		for (TickBudget *b : registry())
+		{
+			const Real ms = Real(b->current * 1e-3);
+			b->average = interpolate(b->average, ms, 0.05);
+			b->maximum = max(b->maximum, ms);
+			b->allocations = b->currentAllocations;
+			if (!worst || b->current > worst->current)
+				worst = b;
+		}
+
+		if (period == 0 || total <= period)
+			return;
+		if (worst)
+			worst->overruns++;
+
+		// formatting and logging allocate, so sustained overruns are reported at most once per second
+		const uint64 now = applicationTime();
+		if (now < lastLogTime + 1000000)
+		{
+			unloggedOverruns++;
+			return;
+		}
+		lastLogTime = now;
+		Stringizer s;
+		s + "control tick took " + (total * 1e-3) + " ms of " + (period * 1e-3) + " ms:";
+		for (TickBudget *b : registry())
+			if (b->current)
+				s + " " + b->name + " " + (b->current * 1e-3);
+		if (unloggedOverruns)
+			s + " (and " + unloggedOverruns + " more overruns since the previous report)";
+		unloggedOverruns = 0;
+		CAGE_LOG(SeverityEnum::Warning, "tickBudget", s);
+	}
+
+	class Callbacks
+	{
+		EventListener<void()> tickBeginListener;
+		EventListener<void()> tickEndListener;
+	public:
+		Callbacks()
+		{
+			// surround all other listeners
+			tickBeginListener.attach(controlThread().update, -1000000);
+			tickBeginListener.bind<&tickBegin>();
+			tickEndListener.attach(controlThread().update, 1000000);
+			tickEndListener.bind<&tickEnd>();
+		}
+	} callbacksInstance;
+}
+
+TickBudget::TickBudget(const char *name) : name(name)
+{
+	registry().push_back(this);
+}
+
+TickBudgetScope::TickBudgetScope(TickBudget &budget) : budget(budget), start(applicationTime()), startAllocations(frameHeapAllocationsSoFar())
+{}
+
+TickBudgetScope::~TickBudgetScope()
+{
+	budget.current += applicationTime() - start;
+	budget.currentAllocations += frameHeapAllocationsSoFar() - startAllocations;
+}
+
+PointerRange<TickBudget *const> tickBudgets()
+{
+	return registry();
+}
+
+Real tickBudgetUtilization()
+{
+	return utilization;
+}
@@ -0,0 +1,38 @@
+#ifndef flittermouse_tickBudget_h_q3n8v2c5
+#define flittermouse_tickBudget_h_q3n8v2c5
+
+#include "common.h"
+
+// time spent by one control thread update listener
+// declare one per module at namespace scope, and open a TickBudgetScope at the start of its update
+struct TickBudget
+{
+	explicit TickBudget(const char *name);
+
+	const char *name = nullptr;
+	Real average; // milliseconds, moving average
+	Real maximum; // milliseconds
+	uint32 overruns = 0; // overrunning ticks in which this listener took the most time
+	uint64 current = 0; // microseconds in the current tick
+	uint32 allocations = 0; // global heap allocations in the last tick, debug builds only
+	uint32 currentAllocations = 0;
+};
+
+struct TickBudgetScope
+{
+	explicit TickBudgetScope(TickBudget &budget);
+	~TickBudgetScope();
+
+	TickBudgetScope(const TickBudgetScope &) = delete;
+	TickBudgetScope &operator = (const TickBudgetScope &) = delete;
+
+private:
+	TickBudget &budget;
+	uint64 start = 0;
+	uint32 startAllocations = 0;
+};
+
+PointerRange<TickBudget *const> tickBudgets();
+Real tickBudgetUtilization(); // moving average of the tick duration relative to the update period
+
+#endif
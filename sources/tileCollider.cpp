@@ -0,0 +1,583 @@
+#include "tileCollider.h"
+
+#include <cage-core/geometry.h>
+#include <cage-core/mesh.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <cmath> // INFINITY
+
+namespace
+{
+	constexpr uint32 LeafSize = 8;
+	constexpr uint32 QuantizationSteps = 65535;
+
+	struct BuildTriangle
+	{
+		uint32 ids[3] = {};
+		uint16 low[3] = {};
+		uint16 high[3] = {};
+		uint32 centroid[3] = {}; // sum of the three vertices
+	};
+
+	struct Builder
+	{
+		TileCollider &c;
+		std::vector<BuildTriangle> tris;
+
+		explicit Builder(TileCollider &c) : c(c)
+		{}
+
+		uint32 build(uint32 begin, uint32 end)
+		{
+			CAGE_ASSERT(end > begin);
+			const uint32 nodeIndex = numeric_cast<uint32>(c.nodes.size());
+			c.nodes.emplace_back();
+
+			uint16 low[3] = { 65535, 65535, 65535 };
+			uint16 high[3] = {};
+			uint32 cLow[3] = { m, m, m };
+			uint32 cHigh[3] = {};
+			for (uint32 i = begin; i < end; i++)
+			{
+				const BuildTriangle &t = tris[i];
+				for (uint32 a = 0; a < 3; a++)
+				{
+					low[a] = std::min(low[a], t.low[a]);
+					high[a] = std::max(high[a], t.high[a]);
+					cLow[a] = std::min(cLow[a], t.centroid[a]);
+					cHigh[a] = std::max(cHigh[a], t.centroid[a]);
+				}
+			}
+			{
+				TileCollider::Node &n = c.nodes[nodeIndex];
+				for (uint32 a = 0; a < 3; a++)
+				{
+					n.low[a] = low[a];
+					n.high[a] = high[a];
+				}
+			}
+
+			if (end - begin <= LeafSize)
+			{
+				c.nodes[nodeIndex].data = (begin << 4) | (end - begin);
+				return nodeIndex;
+			}
+
+			uint32 axis = 0;
+			for (uint32 a = 1; a < 3; a++)
+				if (cHigh[a] - cLow[a] > cHigh[axis] - cLow[axis])
+					axis = a;
+			const uint32 mid = (begin + end) / 2;
+			std::nth_element(tris.begin() + begin, tris.begin() + mid, tris.begin() + end, [axis](const BuildTriangle &a, const BuildTriangle &b) {
+				return a.centroid[axis] < b.centroid[axis];
+			});
+
+			build(begin, mid);
+			const uint32 second = build(mid, end);
+			c.nodes[nodeIndex].data = second << 4;
+			return nodeIndex;
+		}
+	};
+
+	// returns the line parameter of the intersection or infinity
+	float intersectTriangle(const float o[3], const float d[3], const float a[3], const float b[3], const float c[3])
+	{
+		const float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		const float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		const float p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+		const float det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		if (det > -1e-12f && det < 1e-12f)
+			return INFINITY;
+		const float inv = 1 / det;
+		const float s[3] = { o[0] - a[0], o[1] - a[1], o[2] - a[2] };
+		const float u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+		if (u < 0 || u > 1)
+			return INFINITY;
+		const float q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+		const float v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+		if (v < 0 || u + v > 1)
+			return INFINITY;
+		return (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+	}
+
+	struct ConeSearch
+	{
+		Cone cone;
+		Real cosAngle;
+		Real sinAngle;
+		Real best; // squared distance
+		Vec3 point;
+
+		bool inside(const Vec3 &p) const
+		{
+			const Vec3 w = p - cone.origin;
+			const Real l = length(w);
+			return dot(w, cone.direction) >= (cosAngle - 1e-5) * l;
+		}
+
+		bool consider(const Vec3 &p)
+		{
+			const Real d = distanceSquared(p, cone.origin);
+			if (d >= best || !inside(p))
+				return false;
+			best = d;
+			point = p;
+			return true;
+		}
+
+		// the part of the edge inside the cone is an interval, bounded by roots of a quadratic
+		bool edge(const Vec3 &a, const Vec3 &b)
+		{
+			const Vec3 e = b - a;
+			const Vec3 w = a - cone.origin;
+			const Real ee = dot(e, e);
+			if (ee < 1e-12)
+				return false;
+			const Real ea = dot(e, cone.direction);
+			const Real wa = dot(w, cone.direction);
+			const Real c2 = sqr(cosAngle);
+			const Real qa = sqr(ea) - c2 * ee;
+			const Real qb = 2 * (wa * ea - c2 * dot(w, e));
+			const Real qc = sqr(wa) - c2 * dot(w, w);
+			Real breaks[4] = { 0 };
+			uint32 cnt = 1;
+			const auto &add = [&](Real s) {
+				if (s > 0 && s < 1)
+					breaks[cnt++] = s;
+			};
+			if (abs(qa) < 1e-12)
+			{
+				if (abs(qb) > 1e-12)
+					add(-qc / qb);
+			}
+			else
+			{
+				const Real disc = sqr(qb) - 4 * qa * qc;
+				if (disc >= 0)
+				{
+					const Real sq = sqrt(disc);
+					const Real s1 = (-qb - sq) / (2 * qa);
+					const Real s2 = (-qb + sq) / (2 * qa);
+					add(min(s1, s2));
+					add(max(s1, s2));
+				}
+			}
+			breaks[cnt++] = 1;
+
+			bool found = false;
+			const Real proj = -dot(w, e) / ee;
+			for (uint32 i = 0; i + 1 < cnt; i++)
+			{
+				const Real s0 = breaks[i], s1 = breaks[i + 1];
+				if (!inside(a + e * ((s0 + s1) * 0.5)))
+					continue;
+				found = consider(a + e * clamp(proj, s0, s1)) || found;
+			}
+			return found;
+		}
+
+		// the closest point of the whole conic, where the cone surface crosses the triangle plane, lies on the generator leaning most towards the plane
+		bool conic(const Triangle &t)
+		{
+			const Vec3 n = t.normal();
+			const Real h = dot(t[0] - cone.origin, n);
+			const Vec3 toward = h >= 0 ? n : -n;
+			Vec3 perp = toward - cone.direction * dot(toward, cone.direction);
+			if (lengthSquared(perp) < 1e-12)
+				return false;
+			perp = normalize(perp);
+			const Vec3 g = cone.direction * cosAngle + perp * sinAngle;
+			const Real gd = dot(g, toward);
+			if (gd < 1e-7)
+				return false;
+			const Vec3 p = cone.origin + g * (abs(h) / gd);
+			for (uint32 i = 0; i < 3; i++)
+				if (dot(cross(t[(i + 1) % 3] - t[i], p - t[i]), n) < 0)
+					return false; // outside the triangle
+			return consider(p);
+		}
+
+		// the intersection of the triangle with the cone is convex, so its closest point is either the unconstrained closest point, or on its boundary
+		bool triangle(const Triangle &t)
+		{
+			const Vec3 q = closestPoint(t, cone.origin);
+			if (inside(q))
+				return consider(q);
+			bool found = false;
+			for (uint32 i = 0; i < 3; i++)
+				found = edge(t[i], t[(i + 1) % 3]) || found;
+			found = conic(t) || found;
+			return found;
+		}
+	};
+}
+
+void RayPacket::prepare()
+{
+	for (uint32 a = 0; a < 3; a++)
+		for (uint32 i = 0; i < count; i++)
+			inverse[a][i] = direction[a][i] != 0 ? 1 / direction[a][i] : 1e30f;
+}
+
+bool RayPacket::intersects(const float low[3], const float high[3]) const
+{
+	bool any = false;
+	for (uint32 i = 0; i < count; i++)
+	{
+		float t0 = minimum[i], t1 = distance[i];
+		for (uint32 a = 0; a < 3; a++)
+		{
+			const float u = (low[a] - origin[a][i]) * inverse[a][i];
+			const float v = (high[a] - origin[a][i]) * inverse[a][i];
+			t0 = std::max(t0, std::min(u, v));
+			t1 = std::min(t1, std::max(u, v));
+		}
+		any |= t0 <= t1;
+	}
+	return any;
+}
+
+Vec3 TileCollider::vertex(uint32 index) const
+{
+	const uint16 *q = vertices.data() + index * 3;
+	return origin + Vec3(q[0], q[1], q[2]) * step;
+}
+
+Triangle TileCollider::triangle(uint32 index) const
+{
+	const uint32 *ids = indices.data() + index * 3;
+	return Triangle(vertex(ids[0]), vertex(ids[1]), vertex(ids[2]));
+}
+
+Aabb TileCollider::box() const
+{
+	if (nodes.empty())
+		return Aabb();
+	const Node &n = nodes[0];
+	return Aabb(origin + Vec3(n.low[0], n.low[1], n.low[2]) * step, origin + Vec3(n.high[0], n.high[1], n.high[2]) * step);
+}
+
+uintPtr TileCollider::memoryUsage() const
+{
+	return sizeof(TileCollider) + nodes.capacity() * sizeof(Node) + vertices.capacity() * sizeof(uint16) + indices.capacity() * sizeof(uint32);
+}
+
+bool TileCollider::intersection(const Vec3 &lineOrigin, const Vec3 &lineDirection, Real minimum, Real &distance, uint32 &triangle) const
+{
+	if (nodes.empty())
+		return false;
+
+	// transform the line into the quantized space, which preserves the line parameter
+	float o[3], d[3], inv[3];
+	for (uint32 a = 0; a < 3; a++)
+	{
+		o[a] = ((lineOrigin[a] - origin[a]) / step[a]).value;
+		d[a] = (lineDirection[a] / step[a]).value;
+		inv[a] = d[a] != 0 ? 1 / d[a] : 1e30f;
+	}
+
+	const float tMin = minimum.value;
+	float best = distance.value;
+	uint32 bestTriangle = m;
+	uint32 stack[64];
+	uint32 stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize)
+	{
+		const uint32 nodeIndex = stack[--stackSize];
+		const Node &n = nodes[nodeIndex];
+		float t0 = tMin, t1 = best;
+		for (uint32 a = 0; a < 3; a++)
+		{
+			float u = (n.low[a] - o[a]) * inv[a];
+			float v = (n.high[a] - o[a]) * inv[a];
+			if (u > v)
+				std::swap(u, v);
+			t0 = std::max(t0, u);
+			t1 = std::min(t1, v);
+		}
+		if (t0 > t1)
+			continue;
+
+		const uint32 count = n.data & 15;
+		if (count)
+		{
+			const uint32 first = n.data >> 4;
+			for (uint32 i = first; i < first + count; i++)
+			{
+				float vs[3][3];
+				for (uint32 j = 0; j < 3; j++)
+				{
+					const uint16 *q = vertices.data() + indices[i * 3 + j] * 3;
+					for (uint32 a = 0; a < 3; a++)
+						vs[j][a] = q[a];
+				}
+				const float t = intersectTriangle(o, d, vs[0], vs[1], vs[2]);
+				if (t >= tMin && t < best)
+				{
+					best = t;
+					bestTriangle = i;
+				}
+			}
+			continue;
+		}
+
+		CAGE_ASSERT(stackSize + 2 <= sizeof(stack) / sizeof(stack[0]));
+		stack[stackSize++] = n.data >> 4;
+		stack[stackSize++] = nodeIndex + 1;
+	}
+
+	if (bestTriangle == m)
+		return false;
+	distance = best;
+	triangle = bestTriangle;
+	return true;
+}
+
+bool TileCollider::intersection(const Vec3 &lineOrigin, const Vec3 &lineDirection, Real minimum, Real &distance, uint32 &triangle, uint32 firstTriangle, uint32 trianglesCount) const
+{
+	CAGE_ASSERT(firstTriangle + trianglesCount <= this->trianglesCount());
+	float o[3], d[3];
+	for (uint32 a = 0; a < 3; a++)
+	{
+		o[a] = ((lineOrigin[a] - origin[a]) / step[a]).value;
+		d[a] = (lineDirection[a] / step[a]).value;
+	}
+	const float tMin = minimum.value;
+	float best = distance.value;
+	uint32 bestTriangle = m;
+	for (uint32 i = firstTriangle; i < firstTriangle + trianglesCount; i++)
+	{
+		float vs[3][3];
+		for (uint32 j = 0; j < 3; j++)
+		{
+			const uint16 *q = vertices.data() + indices[i * 3 + j] * 3;
+			for (uint32 a = 0; a < 3; a++)
+				vs[j][a] = q[a];
+		}
+		const float t = intersectTriangle(o, d, vs[0], vs[1], vs[2]);
+		if (t >= tMin && t < best)
+		{
+			best = t;
+			bestTriangle = i;
+		}
+	}
+	if (bestTriangle == m)
+		return false;
+	distance = best;
+	triangle = bestTriangle;
+	return true;
+}
+
+bool TileCollider::closestInCone(const Cone &cone, Real &distance, Vec3 &point, uint32 &triangle) const
+{
+	CAGE_ASSERT(abs(length(cone.direction) - 1) < 1e-3);
+	CAGE_ASSERT(cone.halfAngle < Degs(90));
+	if (nodes.empty())
+		return false;
+
+	ConeSearch search;
+	search.cone = cone;
+	search.cosAngle = cos(cone.halfAngle);
+	search.sinAngle = sin(cone.halfAngle);
+	search.best = sqr(distance);
+	uint32 bestTriangle = m;
+
+	uint32 stack[64];
+	uint32 stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize)
+	{
+		const uint32 nodeIndex = stack[--stackSize];
+		const Node &n = nodes[nodeIndex];
+		const Aabb box = Aabb(origin + Vec3(n.low[0], n.low[1], n.low[2]) * step, origin + Vec3(n.high[0], n.high[1], n.high[2]) * step);
+		if (sqr(cage::distance(box, cone.origin)) >= search.best)
+			continue;
+		search.cone.length = sqrt(search.best);
+		if (!intersects(search.cone, box))
+			continue;
+
+		const uint32 count = n.data & 15;
+		if (count)
+		{
+			const uint32 first = n.data >> 4;
+			for (uint32 i = first; i < first + count; i++)
+				if (search.triangle(this->triangle(i)))
+					bestTriangle = i;
+			continue;
+		}
+
+		CAGE_ASSERT(stackSize + 2 <= sizeof(stack) / sizeof(stack[0]));
+		stack[stackSize++] = n.data >> 4;
+		stack[stackSize++] = nodeIndex + 1;
+	}
+
+	if (bestTriangle == m)
+		return false;
+	distance = sqrt(search.best);
+	point = search.point;
+	triangle = bestTriangle;
+	return true;
+}
+
+bool TileCollider::intersection(RayPacket &packet) const
+{
+	if (nodes.empty() || packet.count == 0)
+		return false;
+
+	// transform the rays into the quantized space, which preserves the line parameters
+	RayPacket q;
+	q.count = packet.count;
+	for (uint32 a = 0; a < 3; a++)
+	{
+		const float o = origin[a].value;
+		const float s = 1 / step[a].value;
+		for (uint32 i = 0; i < q.count; i++)
+		{
+			q.origin[a][i] = (packet.origin[a][i] - o) * s;
+			q.direction[a][i] = packet.direction[a][i] * s;
+		}
+	}
+	for (uint32 i = 0; i < q.count; i++)
+	{
+		q.minimum[i] = packet.minimum[i];
+		q.distance[i] = packet.distance[i];
+		q.triangle[i] = m;
+	}
+	q.prepare();
+
+	bool found = false;
+	uint32 stack[64];
+	uint32 stackSize = 0;
+	stack[stackSize++] = 0;
+	while (stackSize)
+	{
+		const uint32 nodeIndex = stack[--stackSize];
+		const Node &n = nodes[nodeIndex];
+		const float low[3] = { float(n.low[0]), float(n.low[1]), float(n.low[2]) };
+		const float high[3] = { float(n.high[0]), float(n.high[1]), float(n.high[2]) };
+		if (!q.intersects(low, high))
+			continue;
+
+		const uint32 count = n.data & 15;
+		if (count)
+		{
+			const uint32 first = n.data >> 4;
+			for (uint32 t = first; t < first + count; t++)
+			{
+				float vs[3][3];
+				for (uint32 j = 0; j < 3; j++)
+				{
+					const uint16 *v = vertices.data() + indices[t * 3 + j] * 3;
+					for (uint32 a = 0; a < 3; a++)
+						vs[j][a] = v[a];
+				}
+				for (uint32 i = 0; i < q.count; i++)
+				{
+					const float o[3] = { q.origin[0][i], q.origin[1][i], q.origin[2][i] };
+					const float d[3] = { q.direction[0][i], q.direction[1][i], q.direction[2][i] };
+					const float h = intersectTriangle(o, d, vs[0], vs[1], vs[2]);
+					if (h >= q.minimum[i] && h < q.distance[i])
+					{
+						q.distance[i] = h;
+						q.triangle[i] = t;
+						found = true;
+					}
+				}
+			}
+			continue;
+		}
+
+		CAGE_ASSERT(stackSize + 2 <= sizeof(stack) / sizeof(stack[0]));
+		stack[stackSize++] = n.data >> 4;
+		stack[stackSize++] = nodeIndex + 1;
+	}
+
+	for (uint32 i = 0; i < q.count; i++)
+	{
+		if (q.triangle[i] == m)
+			continue;
+		packet.distance[i] = q.distance[i];
+		packet.triangle[i] = q.triangle[i];
+	}
+	return found;
+}
+
+Holder<TileCollider> newTileCollider(const Mesh *mesh)
+{
+	CAGE_ASSERT(mesh->type() == MeshTypeEnum::Triangles);
+	Holder<TileCollider> c = systemMemory().createHolder<TileCollider>();
+	if (mesh->indicesCount() == 0)
+		return c;
+
+	{ // quantization
+		Vec3 low = Vec3(Real::Infinity());
+		Vec3 high = Vec3(-Real::Infinity());
+		for (const Vec3 &p : mesh->positions())
+		{
+			low = min(low, p);
+			high = max(high, p);
+		}
+		c->origin = low;
+		c->step = max((high - low) / QuantizationSteps, Vec3(1e-7));
+	}
+
+	// quantize and weld vertices
+	std::vector<uint32> remap;
+	remap.reserve(mesh->verticesCount());
+	{
+		std::unordered_map<uint64, uint32> welded;
+		welded.reserve(mesh->verticesCount());
+		for (const Vec3 &p : mesh->positions())
+		{
+			uint16 qs[3];
+			for (uint32 a = 0; a < 3; a++)
+				qs[a] = numeric_cast<uint16>(clamp(round((p[a] - c->origin[a]) / c->step[a]), 0, QuantizationSteps));
+			const uint64 key = uint64(qs[0]) | (uint64(qs[1]) << 16) | (uint64(qs[2]) << 32);
+			auto it = welded.find(key);
+			if (it == welded.end())
+			{
+				const uint32 index = numeric_cast<uint32>(c->vertices.size() / 3);
+				it = welded.emplace(key, index).first;
+				c->vertices.insert(c->vertices.end(), qs, qs + 3);
+			}
+			remap.push_back(it->second);
+		}
+	}
+
+	Builder builder(*c);
+	{ // triangles
+		const auto inds = mesh->indices();
+		builder.tris.reserve(inds.size() / 3);
+		for (uint32 i = 0; i < inds.size(); i += 3)
+		{
+			BuildTriangle t;
+			for (uint32 j = 0; j < 3; j++)
+				t.ids[j] = remap[inds[i + j]];
+			if (t.ids[0] == t.ids[1] || t.ids[1] == t.ids[2] || t.ids[2] == t.ids[0])
+				continue; // degenerated by welding
+			for (uint32 a = 0; a < 3; a++)
+			{
+				const uint16 v0 = c->vertices[t.ids[0] * 3 + a];
+				const uint16 v1 = c->vertices[t.ids[1] * 3 + a];
+				const uint16 v2 = c->vertices[t.ids[2] * 3 + a];
+				t.low[a] = std::min(std::min(v0, v1), v2);
+				t.high[a] = std::max(std::max(v0, v1), v2);
+				t.centroid[a] = uint32(v0) + v1 + v2;
+			}
+			builder.tris.push_back(t);
+		}
+	}
+	if (builder.tris.empty())
+		return c;
+
+	c->nodes.reserve(builder.tris.size() * 2 / LeafSize + 1);
+	builder.build(0, numeric_cast<uint32>(builder.tris.size()));
+	c->indices.reserve(builder.tris.size() * 3);
+	for (const BuildTriangle &t : builder.tris)
+		c->indices.insert(c->indices.end(), t.ids, t.ids + 3);
+	c->nodes.shrink_to_fit();
+	c->vertices.shrink_to_fit();
+	return c;
+}
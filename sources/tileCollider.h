@@ -0,0 +1,75 @@
+#ifndef flittermouse_tileCollider_h_f4g8t5r1
+#define flittermouse_tileCollider_h_f4g8t5r1
+
+#include "common.h"
+
+#include <vector>
+
+namespace cage
+{
+	class Mesh;
+}
+
+// coherent rays processed together, in structure of arrays layout
+struct RayPacket
+{
+	static constexpr uint32 Size = 16;
+
+	float origin[3][Size];
+	float direction[3][Size]; // need not be normalized
+	float inverse[3][Size]; // filled by prepare
+	float minimum[Size];
+	float distance[Size]; // maximum on input, updated with closer hits
+	uint32 triangle[Size];
+	uint32 count = 0;
+
+	void prepare();
+
+	// true if any of the rays intersects the box between its minimum and current distance
+	bool intersects(const float low[3], const float high[3]) const;
+};
+
+// compact collider for a single terrain tile
+// vertices are quantized to 16 bits inside the local bounding box and shared between triangles
+// bvh nodes store bounds in the same quantized space and are expanded to floats only during traversal
+struct TileCollider
+{
+	struct Node
+	{
+		uint16 low[3] = {};
+		uint16 high[3] = {};
+		uint32 data = 0; // leaf: (first triangle << 4) | count; inner: (second child << 4), first child follows immediately
+	};
+
+	std::vector<Node> nodes;
+	std::vector<uint16> vertices; // 3 components per vertex
+	std::vector<uint32> indices; // 3 per triangle, ordered by bvh leaves
+	Vec3 origin; // local position of quantized zero
+	Vec3 step; // local size of one quantization step
+
+	uint32 trianglesCount() const { return numeric_cast<uint32>(indices.size() / 3); }
+	Vec3 vertex(uint32 index) const;
+	Triangle triangle(uint32 index) const; // local space
+	Aabb box() const; // local space
+	uintPtr memoryUsage() const;
+
+	// finds the closest triangle along the line, in local space, the direction need not be normalized
+	// returns true and updates distance and triangle if there is a hit closer than the given distance
+	bool intersection(const Vec3 &lineOrigin, const Vec3 &lineDirection, Real minimum, Real &distance, uint32 &triangle) const;
+
+	// same, but tests only the given range of triangles, without the bvh
+	// triangles close in the order are close in space too
+	bool intersection(const Vec3 &lineOrigin, const Vec3 &lineDirection, Real minimum, Real &distance, uint32 &triangle, uint32 firstTriangle, uint32 trianglesCount) const;
+
+	// finds the closest point on the triangles, to the cone origin, that lies inside the cone (in local space)
+	// the cone direction must be normalized, the half angle must be less than 90 degrees
+	// returns true and updates the distance, point, and triangle if there is a point closer than the given distance
+	bool closestInCone(const Cone &cone, Real &distance, Vec3 &point, uint32 &triangle) const;
+
+	// same for all rays in the packet (in local space), the bvh is traversed once for the whole packet
+	bool intersection(RayPacket &packet) const;
+};
+
+Holder<TileCollider> newTileCollider(const Mesh *mesh);
+
+#endif
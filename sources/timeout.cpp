@@ -1,4 +1,6 @@
 #include "common.h"
+#include "profiler.h"
+#include "tickBudget.h"
 
 #include <cage-core/entities.h>
 #include <cage-core/hashString.h>
@@ -6,19 +8,78 @@
 #include <cage-engine/scene.h>
 #include <cage-simple/engine.h>
 
+#include <array>
+#include <vector>
+
 EntityGroup *entitiesToDestroy;
 
 namespace
 {
+	// hierarchical timer wheel, each tick touches only the entities that expire in it
+	// the first level has one slot per tick, the second level one slot per 256 ticks
+	// timeouts further away wait in the overflow list, which is revisited every 65536 ticks
+
+	struct Expiry
+	{
+		uint64 expiry = 0;
+		uint32 name = 0;
+	};
+
+	constexpr uint32 SlotsBits = 8;
+	constexpr uint32 SlotsCount = 1 << SlotsBits;
+	constexpr uint32 SlotsMask = SlotsCount - 1;
+
+	std::array<std::vector<Expiry>, SlotsCount> level0;
+	std::array<std::vector<Expiry>, SlotsCount> level1;
+	std::vector<Expiry> overflow;
+	std::vector<Expiry> scratch;
+	uint64 currentTick = 0;
+
+	void insert(const Expiry &t)
+	{
+		CAGE_ASSERT(t.expiry >= currentTick);
+		const uint64 delta = t.expiry - currentTick;
+		if (delta < SlotsCount)
+			level0[t.expiry & SlotsMask].push_back(t);
+		else if (delta < SlotsCount * SlotsCount)
+			level1[(t.expiry >> SlotsBits) & SlotsMask].push_back(t);
+		else
+			overflow.push_back(t);
+	}
+
+	void cascade(std::vector<Expiry> &slot)
+	{
+		std::swap(scratch, slot);
+		for (const Expiry &t : scratch)
+			insert(t);
+		scratch.clear();
+	}
+
+	TickBudget tickBudget("timeout");
+
 	void engineUpdate()
 	{
-		for (Entity *e : engineEntities()->component<TimeoutComponent>()->entities())
+		TickBudgetScope budgetScope(tickBudget);
+		FLITTERMOUSE_PROFILE("timeout update");
+		if ((currentTick & (SlotsCount * SlotsCount - 1)) == 0)
+			cascade(overflow);
+		if ((currentTick & SlotsMask) == 0)
+			cascade(level1[(currentTick >> SlotsBits) & SlotsMask]);
+
+		EntityManager *ents = engineEntities();
+		std::vector<Expiry> &slot = level0[currentTick & SlotsMask];
+		for (const Expiry &t : slot)
 		{
-			TimeoutComponent &t = e->value<TimeoutComponent>();
-			if (t.ttl-- == 0)
-				e->add(entitiesToDestroy);
+			CAGE_ASSERT(t.expiry == currentTick);
+			Entity *e = ents->tryGet(t.name);
+			// the entity may have been destroyed or rescheduled meanwhile
+			if (!e || !e->has<TimeoutComponent>() || e->value<TimeoutComponent>().expiry != t.expiry)
+				continue;
+			e->add(entitiesToDestroy);
 		}
+		slot.clear();
 		entitiesToDestroy->destroy();
+		currentTick++;
 	}
 
 	void engineInitialize()
@@ -27,10 +88,20 @@ namespace
 		engineEntities()->defineComponent(TimeoutComponent());
 	}
 
+	void engineFinalize()
+	{
+		for (auto &s : level0)
+			s.clear();
+		for (auto &s : level1)
+			s.clear();
+		overflow.clear();
+	}
+
 	class Callbacks
 	{
 		EventListener<void()> engineInitListener;
 		EventListener<void()> engineUpdateListener;
+		EventListener<void()> engineFinalizeListener;
 	public:
 		Callbacks()
 		{
@@ -38,6 +109,18 @@ namespace
 			engineInitListener.bind<&engineInitialize>();
 			engineUpdateListener.attach(controlThread().update);
 			engineUpdateListener.bind<&engineUpdate>();
+			engineFinalizeListener.attach(controlThread().finalize);
+			engineFinalizeListener.bind<&engineFinalize>();
 		}
 	} callbacksInstance;
 }
+
+void timeoutSchedule(Entity *e, uint32 ttl)
+{
+	CAGE_ASSERT(e->name() != 0);
+	Expiry t;
+	t.expiry = currentTick + ttl;
+	t.name = e->name();
+	e->value<TimeoutComponent>().expiry = t.expiry;
+	insert(t);
+}
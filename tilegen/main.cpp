@@ -0,0 +1,174 @@
+#include "../sources/terrain/terrain.h"
+#include "../sources/tileCollider.h"
+
+#include <cage-core/logger.h>
+#include <cage-core/config.h>
+#include <cage-core/files.h>
+#include <cage-core/ini.h>
+#include <cage-core/concurrent.h>
+#include <cage-core/networkTcp.h>
+
+#include <exception>
+
+using namespace cage;
+
+namespace
+{
+	uint64 durations[(uint32)TileMetricEnum::Count];
+	bool initializedSeed = false;
+}
+
+// the stages are sent back with the result and recorded by the game
+void terrainMetricsRecord(TileMetricEnum metric, sint32, uint64 duration)
+{
+	CAGE_ASSERT(metric < TileMetricEnum::Count);
+	durations[(uint32)metric] += duration;
+}
+
+namespace
+{
+	// the jobs come from the network, anything the game could not have sent is rejected before it reaches the generator
+	void validate(const TerrainRemoteJob &job)
+	{
+		const TilePos &p = job.tilePos;
+		bool radiusOk = false;
+		for (sint32 r = TerrainFinestRadius; r <= TerrainCoarsestRadius; r *= 2)
+			radiusOk = radiusOk || p.radius == r;
+		if (!radiusOk)
+			CAGE_THROW_ERROR(Exception, "invalid tile radius");
+		for (uint32 i = 0; i < 3; i++)
+			if (p.pos[i] % p.radius != 0)
+				CAGE_THROW_ERROR(Exception, "invalid tile position");
+		switch (job.type)
+		{
+			case TerrainRemoteMessageEnum::Tile:
+				if (!job.view.position.valid() || !job.view.viewScale.valid() || job.view.viewScale <= 0)
+					CAGE_THROW_ERROR(Exception, "invalid player view");
+				break;
+			case TerrainRemoteMessageEnum::Collider:
+				if (job.meshResolution < TerrainMeshResolutionMin || job.meshResolution > TerrainMeshResolutionMax)
+					CAGE_THROW_ERROR(Exception, "invalid mesh resolution");
+				break;
+			default:
+				break;
+		}
+	}
+
+	// the workers serve only the game on the same machine
+	bool isLocal(const String &address)
+	{
+		return isPattern(address, "127.", "", "") || address == "::1" || isPattern(address, "::ffff:127.", "", "");
+	}
+
+	void process(const TerrainRemoteJob &job, TerrainRemoteResult &result)
+	{
+		switch (job.type)
+		{
+			case TerrainRemoteMessageEnum::Hello:
+				CAGE_LOG(SeverityEnum::Info, "tilegen", Stringizer() + "seed: " + job.seed);
+				if (!initializedSeed)
+				{
+					terrainInitialize(job.seed);
+					initializedSeed = true;
+				}
+				else if (terrainSeed() != job.seed)
+				{
+					CAGE_LOG(SeverityEnum::Warning, "tilegen", "the terrain is already initialized with different seed, restart the worker");
+					result.type = TerrainRemoteMessageEnum::Failure;
+				}
+				break;
+			case TerrainRemoteMessageEnum::Tile:
+				validate(job);
+				for (uint64 &d : durations)
+					d = 0;
+				terrainGenerate(job.tilePos, job.view, result.parts, result.meshResolution, result.albedo, result.special);
+				for (uint32 i = 0; i < (uint32)TileMetricEnum::Count; i++)
+					result.durations[i] = durations[i];
+				break;
+			case TerrainRemoteMessageEnum::Collider:
+				validate(job);
+				result.collider = terrainGenerateCollider(job.tilePos, job.meshResolution);
+				break;
+			default:
+				CAGE_THROW_ERROR(Exception, "unexpected terrain job type");
+		}
+	}
+
+	// one connection at a time, the game uses one worker per generator thread
+	void serve(TcpConnection *connection)
+	{
+		while (true)
+		{
+			TerrainRemoteJob job;
+			terrainRemoteReceive(connection, job); // throws when the game disconnects
+			if (job.type != TerrainRemoteMessageEnum::Hello && !initializedSeed)
+				CAGE_THROW_ERROR(Exception, "terrain job before hello");
+			TerrainRemoteResult result;
+			try
+			{
+				process(job, result);
+			}
+			catch (...)
+			{
+				// the game generates the tile in process instead
+				detail::logCurrentCaughtException();
+				result = TerrainRemoteResult();
+				result.type = TerrainRemoteMessageEnum::Failure;
+			}
+			terrainRemoteSend(connection, result);
+		}
+	}
+}
+
+int main(int argc, const char *args[])
+{
+	try
+	{
+		Holder<Logger> log1 = newLogger();
+		log1->format.bind<logFormatConsole>();
+		log1->output.bind<logOutputStdOut>();
+
+		Holder<Ini> cmd = newIni();
+		cmd->parseCmd(argc, args);
+		const uint16 port = numeric_cast<uint16>(cmd->cmdUint32('p', "port", 27630));
+		const String config = cmd->cmdString('c', "config", "flittermouse.ini");
+		cmd->checkUnusedWithHelp();
+
+		// the generator must use the same configuration as the game
+		if (pathIsFile(config))
+			configLoadIni(config, "flittermouse");
+		else
+			CAGE_LOG(SeverityEnum::Warning, "tilegen", Stringizer() + "configuration file not found: " + config);
+
+		Holder<TcpServer> server = newTcpServer(port);
+		CAGE_LOG(SeverityEnum::Info, "tilegen", Stringizer() + "listening on port: " + port);
+		while (true)
+		{
+			Holder<TcpConnection> connection = server->accept();
+			if (!connection)
+			{
+				threadSleep(10000);
+				continue;
+			}
+			if (!isLocal(connection->address()))
+			{
+				CAGE_LOG(SeverityEnum::Warning, "tilegen", Stringizer() + "rejected connection from: " + connection->address());
+				continue;
+			}
+			CAGE_LOG(SeverityEnum::Info, "tilegen", Stringizer() + "connection from: " + connection->address());
+			try
+			{
+				serve(+connection);
+			}
+			catch (...)
+			{
+				CAGE_LOG(SeverityEnum::Info, "tilegen", "connection closed");
+			}
+		}
+	}
+	catch (...)
+	{
+		detail::logCurrentCaughtException();
+	}
+	return 1;
+}